@@ -58,7 +58,8 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes, overridden at run time by
+ * mdriver -m or MEM_MAX_HEAP in the environment
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
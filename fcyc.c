@@ -30,6 +30,7 @@ static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
 static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
+static test_funct setup = NULL;
 
 static int *cache_buf = NULL;
 
@@ -133,6 +134,8 @@ double fcyc(test_funct f, void *argp)
     if (compensate) {
 	do {
 	    double cyc;
+	    if (setup)
+		setup(argp);
 	    if (clear_cache)
 		clear();
 	    start_comp_counter();
@@ -143,6 +146,8 @@ double fcyc(test_funct f, void *argp)
     } else {
 	do {
 	    double cyc;
+	    if (setup)
+		setup(argp);
 	    if (clear_cache)
 		clear();
 	    start_counter();
@@ -245,6 +250,16 @@ void set_fcyc_epsilon(double epsilon_arg)
     epsilon = epsilon_arg;
 }
 
+/* 
+ * set_fcyc_setup - When not NULL, setup(argp) is run before each
+ *     measurement, outside of it.
+ *     Default = NULL
+ */
+void set_fcyc_setup(test_funct setup_arg)
+{
+    setup = setup_arg;
+}
+
 
 
 
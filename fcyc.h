@@ -63,6 +63,13 @@ void set_fcyc_maxsamples(int maxsamples_arg);
  */
 void set_fcyc_epsilon(double epsilon_arg);
 
+/* 
+ * set_fcyc_setup - When not NULL, setup(argp) is run before each
+ *     measurement, outside of it.
+ *     Default = NULL
+ */
+void set_fcyc_setup(test_funct setup_arg);
+
 
 
 
@@ -54,4 +54,26 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
+/*
+ * fsecs_setup - Return the running time of a function f (in seconds),
+ *     running setup before each run of f without timing it
+ */
+double fsecs_setup(fsecs_test_funct setup, fsecs_test_funct f, void *argp)
+{
+    double secs;
+
+#if USE_FCYC
+    set_fcyc_setup(setup);
+#else
+    set_ftimer_setup(setup);
+#endif
+    secs = fsecs(f, argp);
+#if USE_FCYC
+    set_fcyc_setup(NULL);
+#else
+    set_ftimer_setup(NULL);
+#endif
+    return secs;
+}
+
 
@@ -16,6 +16,9 @@
 static void init_etime(void);
 static double get_etime(void);
 
+/* run before each timed run of f, if not NULL */
+static ftimer_test_funct setup = NULL;
+
 /* 
  * ftimer_itimer - Use the interval timer to estimate the running time
  * of f(argp). Return the average of n runs.  
@@ -26,6 +29,16 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n)
     int i;
 
     init_etime();
+    if (setup) {
+	tmeas = 0;
+	for (i = 0; i < n; i++) {
+	    setup(argp);
+	    start = get_etime();
+	    f(argp);
+	    tmeas += get_etime() - start;
+	}
+	return tmeas / n;
+    }
     start = get_etime();
     for (i = 0; i < n; i++) 
 	f(argp);
@@ -43,6 +56,17 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     struct timeval stv, etv;
     double diff;
 
+    if (setup) {
+	diff = 0;
+	for (i = 0; i < n; i++) {
+	    setup(argp);
+	    gettimeofday(&stv, NULL);
+	    f(argp);
+	    gettimeofday(&etv, NULL);
+	    diff += 1E3*(etv.tv_sec - stv.tv_sec) + 1E-3*(etv.tv_usec-stv.tv_usec);
+	}
+	return (1E-3*diff/n);
+    }
     gettimeofday(&stv, NULL);
     for (i = 0; i < n; i++) 
 	f(argp);
@@ -52,6 +76,15 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/*
+ * set_ftimer_setup - When not NULL, setup(argp) is run before each run
+ * of f, outside the timing.
+ */
+void set_ftimer_setup(ftimer_test_funct setup_arg)
+{
+    setup = setup_arg;
+}
+
 
 /*
  * Routines for manipulating the Unix interval timer
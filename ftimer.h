@@ -12,3 +12,6 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* When not NULL, run setup(argp) before each run, outside the timing */
+void set_ftimer_setup(ftimer_test_funct setup_arg);
+
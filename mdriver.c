@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,10 +16,22 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "ftimer.h"
 #include "config.h"
 
 /**********************
@@ -27,9 +40,14 @@
 
 /* Misc */
 #define MAXLINE     1024 /* max string size */
+#define RANGE_SLAB  1024 /* range records malloc'd at a time */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Character classes of the trace file tokenizer */
+#define IS_SPACE(c)  ((c) == ' ' || (unsigned)((c) - '\t') <= '\r' - '\t')
+#define IS_DIGIT(c)  ((unsigned)((c) - '0') <= 9)
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -37,17 +55,24 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records of a trace
+ * form an AVL tree ordered by lo, so that the overlap check of each
+ * request only looks at the two neighbours of the new payload.
+ */
 typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    char *lo;                  /* low payload address */
+    char *hi;                  /* high payload address */
+    struct range_t *child[2];  /* subtrees with lower and higher lo */
+    int height;                /* height of the subtree rooted here */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* Characterizes a single trace operation (allocator request) in 8 bytes */
+enum {ALLOC, FREE, REALLOC};          /* types of request */
+#define MAX_IDS (1<<30)               /* ids that fit in index */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
+    unsigned int type : 2;            /* type of request */
+    unsigned int index : 30;          /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
 } traceop_t;
 
@@ -60,7 +85,157 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int first_op;        /* first request to run (nonzero when resuming) */
+    char *ckpt;          /* checkpoint image to resume from (-R), or NULL */
+    size_t ckpt_size;    /* size in bytes of the checkpoint image */
+    unsigned char *tids; /* thread of each request, NULL if all are on 0 */
+    int num_threads;     /* threads in the trace, 1 + the largest tid */
+    int *barriers;       /* requests that no thread may start before... */
+    int num_barriers;    /* ... all of them got to the barrier */
 } trace_t;
+#define MAX_THREADS 64   /* threads a trace may have */
+#define TRACE_TID(trace, i) ((trace)->tids ? (trace)->tids[i] : 0)
+
+/*
+ * A .rpb file is a trace in binary form: this header, then each
+ * request as a varint of index << 2 | type, followed by a varint of
+ * its size unless it is a free. read_trace keeps one next to every
+ * .rep it reads and uses it for as long as the .rep keeps the mtime
+ * and size recorded in it; mdriver -C writes them explicitly.
+ */
+#define RPB_MAGIC 0x31425052 /* "RPB1" */
+#define RPB_HASH_INIT 2166136261u
+typedef struct {
+    unsigned int magic;      /* RPB_MAGIC */
+    int sugg_heapsize;       /* the four numbers of the .rep header */
+    int num_ids;
+    int num_ops;
+    int weight;
+    unsigned int checksum;   /* FNV-1a hash of the packed requests */
+    long long rep_mtime;     /* mtime (ns) and size of the .rep it was */
+    long long rep_size;      /* made from, 0 if none */
+    long long ops_size;      /* bytes of packed requests that follow */
+} rpb_hdr_t;
+
+/*
+ * With -s a trace is replayed as it is read instead of being loaded
+ * first. A decoder thread reads the file STREAM_READ bytes at a time
+ * and decodes it into two chunks of requests, one of which the replay
+ * works through while the other is filled. Block ids go through an
+ * open-addressing hash table of the live blocks, so they can be sparse
+ * and the memory needed is set by the live blocks, not by num_ids.
+ */
+#define STREAM_CHUNK (1<<16)  /* requests per chunk */
+#define STREAM_READ  (1<<20)  /* bytes read from the file at a time */
+#define STREAM_LINE  256      /* longest request line decoded */
+
+typedef struct {
+    traceop_t ops[STREAM_CHUNK];
+    int n;                    /* requests in ops, 0 at the end */
+} chunk_t;
+
+typedef struct {
+    int fd;
+    char *path;
+    int binary;               /* a .rpb file, else a .rep */
+    int num_ids;              /* header of the trace */
+    int num_ops;
+    unsigned char *buf;       /* STREAM_READ bytes read from fd... */
+    size_t pos, len;          /* ... of which these are decoded and read */
+    int eof;
+    unsigned int checksum;    /* of a .rpb, and the hash of the part ... */
+    unsigned int hash;        /* ... before hashpos decoded so far */
+    size_t hashpos;
+    int decoded;              /* requests decoded so far */
+    chunk_t chunk[2];
+    int full[2];              /* chunk has been decoded, not replayed yet */
+    int next;                 /* chunk the replay works on next */
+    int stop;                 /* the replay gave up, stop decoding */
+    pthread_t decoder;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} stream_t;
+
+typedef struct {
+    unsigned int key;         /* block id + 1, 0 if the slot is empty */
+    int size;                 /* payload size */
+    char *block;              /* payload */
+} idslot_t;
+
+typedef struct {
+    idslot_t *slot;
+    int bits;                 /* there are 1 << bits slots */
+    unsigned int count;       /* slots in use */
+} idmap_t;
+#define IDMAP_HASH(map, key) (((key) * 2654435769u) >> (32 - (map)->bits))
+#define IDMAP_MASK(map)      ((1u << (map)->bits) - 1)
+
+/* 
+ * Checkpoint files (-S and -R) hold this header, then one ckpt_block_t
+ * for each block id, then the allocator state written by mm_snapshot.
+ */
+#define CKPT_MAGIC 0x4b434d4d /* "MMCK" */
+typedef struct {
+    unsigned int magic;      /* CKPT_MAGIC */
+    int opnum;               /* requests before this one have been run */
+    int num_ids;             /* number of ckpt_block_t records that follow */
+    char tracepath[MAXLINE]; /* trace file the checkpoint was taken from */
+} ckpt_hdr_t;
+
+typedef struct {
+    int offset;              /* payload offset from mem_heap_lo(), -1 if free */
+    int size;                /* payload size */
+} ckpt_block_t;
+
+/* 
+ * One producer/consumer pair for the -P benchmark: the producer
+ * allocates the trace's blocks and hands them over through a ring
+ * to the consumer, which frees them.
+ */
+#define PIPE_SLOTS 64
+typedef struct pipeline_t {
+    trace_t *trace;
+    pthread_t producer, consumer;
+    char *ring[PIPE_SLOTS];  /* blocks in flight */
+    unsigned head;           /* next slot the producer fills */
+    unsigned tail;           /* next slot the consumer empties */
+} pipeline_t;
+
+/*
+ * One thread of the -W benchmark: it allocates its blocks in lockstep
+ * with the other writers, so their blocks end up interleaved in the
+ * heap, and then keeps writing to a counter at the start of each.
+ */
+#define WRITE_BLOCKS 256     /* blocks per writer */
+#define WRITE_ROUNDS 20000   /* passes of writes over all of them */
+typedef struct writer_t {
+    trace_t *trace;
+    pthread_t tid;
+    pthread_barrier_t *barrier;  /* shared by all writers and main */
+    char *blocks[WRITE_BLOCKS];
+    int nblocks;
+} writer_t;
+
+/* Size-class benchmark (-c) */
+#define CLASS_SIZES  (1<<16) /* request sizes looked up per timing */
+
+/*
+ * One thread of threaded replay (-T): it runs the requests of the trace
+ * threads it was given, in trace order, each once the requests before
+ * it on the same block are done.
+ */
+typedef struct replay_t {
+    trace_t *trace;
+    pthread_t tid;
+    pthread_barrier_t *barrier;  /* start and trace barriers, with main */
+    int *ops;                    /* this thread's requests... */
+    int nops;                    /* ... and how many there are */
+    int *seq;                    /* shared: number of each request on its block */
+    int *done;                   /* shared: requests done on each block */
+    double secs;                 /* time this thread took */
+    double best;                 /* ... in the fastest run */
+} replay_t;
+#define THREAD_RUNS 3   /* timed runs per thread count, after a warm-up */
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -70,6 +245,10 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    struct pipeline_t *pipes; /* producer/consumer pairs for -P ... */
+    int npairs;               /* ... and how many there are */
+    int *live;                /* ids still allocated at the end of the */
+    int nlive;                /* trace, which -M frees after each run */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -81,15 +260,31 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double dtlb;     /* dTLB load misses in one run (-D), -1 if unknown */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* 
+ * With -j the traces are evaluated by worker processes, each with a
+ * heap of its own. They take the traces in turn from this struct, in
+ * memory shared with the driver, and put their stats_t in a shared
+ * array too.
+ */
+typedef struct {
+    int next;               /* next trace for a worker to take */
+    int errors;             /* errors found by all the workers */
+    int serial;             /* if set, one worker at a time times (-X) */
+    pthread_mutex_t timing; /* held by the worker that times (-X) */
+} jobs_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static jobs_t *jobs = NULL; /* shared with the other workers (-j) */
+static int worker = -1; /* this process's number with -j, -1 in the driver */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,16 +300,53 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_alloc(void);
+static range_t *range_balance(range_t *p);
+static range_t *range_insert(range_t *t, range_t *p);
+static range_t *range_delete(range_t *t, char *lo);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static trace_t *read_rep(char *path, struct stat *st);
+static trace_t *read_rpb(char *path, struct stat *rep);
+static int write_rpb(trace_t *trace, char *path, struct stat *rep);
+static trace_t *new_trace(long header[4], char *path);
+static long trace_uint(char **pp, char *end);
+static void set_tid(trace_t *trace, int opnum, int tid);
+static void add_barrier(trace_t *trace, int opnum);
+static char *rpb_path(char *path);
+static void convert_trace(char *tracedir, char *filename);
+
+/* These functions replay a trace as it is read (-s) */
+static void eval_mm_stream(char *tracedir, char *filename, int tracenum,
+			   range_t **ranges, stats_t *stats);
+static int stream_pass(char *tracedir, char *filename, int tracenum,
+		       range_t **ranges, stats_t *stats);
+static stream_t *stream_open(char *tracedir, char *filename);
+static void stream_close(stream_t *s);
+static chunk_t *stream_next(stream_t *s);
+static void stream_release(stream_t *s);
+static void *stream_decoder(void *arg);
+static int stream_decode(stream_t *s, traceop_t *ops);
+static void stream_refill(stream_t *s, size_t want);
+static void idmap_init(idmap_t *map);
+static idslot_t *idmap_find(idmap_t *map, unsigned int id);
+static idslot_t *idmap_insert(idmap_t *map, unsigned int id);
+static void idmap_delete(idmap_t *map, idslot_t *slot);
+static unsigned int rpb_hash(unsigned int h, unsigned char *p, size_t len);
+static int rpb_varint(unsigned char **pp, unsigned char *end, unsigned long long *v);
 static void free_trace(trace_t *trace);
 
+/* These functions save and resume a partially replayed trace */
+static void save_checkpoint(trace_t *trace, char *filename, int opnum);
+static trace_t *load_checkpoint(char *filename);
+static void start_mm_trace(trace_t *trace);
+
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
@@ -124,9 +356,27 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_restore(void *ptr);
+static void eval_mm_replay(void *ptr);
+static void eval_mm_shared(trace_t *trace, int tracenum, int nprocs);
+static void shared_round(void *ptr);
+static void eval_mm_reopen(trace_t *trace, int tracenum, char *path);
+static void eval_mm_pipeline(trace_t *trace, int tracenum, int npairs);
+static void eval_mm_writers(trace_t *trace, int tracenum, int nwriters);
+static void eval_mm_threads(trace_t *trace, int tracenum, int nthreads);
+static double threads_run(trace_t *trace, replay_t *r, int n);
+static void eval_size_class(void);
+
+/* These functions share the traces out among worker processes (-j) */
+static void jobs_start(int njobs, int serial);
+static int jobs_next(int tracenum);
+static void jobs_timing(int start);
+static void jobs_done(void);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printdtlb(int n, stats_t *stats);
+static double dtlb_misses(ftimer_test_funct f, void *argp);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -150,6 +400,22 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int save_op = -1;    /* If set, checkpoint each trace before this op (-S) */
+    char *resume = NULL; /* If set, checkpoint file to resume from (-R) */
+    int shared_procs = 0;/* If set, stress a shared heap with this many (-M) */
+    char *heap_file = NULL; /* If set, time reopening a heap in this file (-A) */
+    int pipe_pairs = 0;  /* If set, producer/consumer pairs to run (-P) */
+    int writers = 0;     /* If set, writer threads to run (-W) */
+    int replay_threads = 0; /* If set, most threads to replay with (-T) */
+    int huge_pages = 0;  /* If set, put the heap on huge pages (-H) */
+    int count_dtlb = 0;  /* If set, count dTLB misses of mm malloc (-D) */
+    int prefault = 0;    /* MEM_PREFAULT_* flags (-p, -F) */
+    size_t pf_ahead = 0; /* distance the pre-fault helper runs ahead (-F) */
+    int class_bench = 0; /* If set, time the size-class lookup only (-c) */
+    int convert = 0;     /* If set, only write the traces as .rpb (-C) */
+    int stream = 0;      /* If set, replay the traces as they are read (-s) */
+    int njobs = 1;       /* worker processes that evaluate the traces (-j) */
+    int serial_timing = 0; /* If set, workers time one at a time (-X) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +424,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalcCHDpsXj:m:A:F:S:R:M:P:T:W:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +450,64 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+	case 'c': /* Time mm_size_class instead of running traces */
+	    class_bench = 1;
+	    break;
+	case 'C': /* Convert the traces to .rpb files and exit */
+	    convert = 1;
+	    break;
+	case 's': /* Replay each trace as it is read, without loading it */
+	    stream = 1;
+	    break;
+	case 'j': /* Evaluate the traces in <n> worker processes */
+	    if ((njobs = atoi(optarg)) < 1)
+		app_error("bad number of workers for -j");
+	    break;
+	case 'X': /* Time one trace at a time even with -j */
+	    serial_timing = 1;
+	    break;
+	case 'H': /* Back the heap with transparent huge pages */
+	    huge_pages = 1;
+	    break;
+	case 'D': /* Count dTLB misses while replaying each trace */
+	    count_dtlb = 1;
+	    break;
+	case 'p': /* Fault in heap memory as mem_sbrk hands it out */
+	    prefault |= MEM_PREFAULT_POPULATE;
+	    break;
+	case 'F': /* Keep <size> bytes past the brk faulted in */
+	    if ((pf_ahead = mem_parse_size(optarg)) == 0)
+		app_error("bad distance for -F");
+	    prefault |= MEM_PREFAULT_THREAD;
+	    break;
+	case 'm': /* Cap the heap at <size> bytes instead of MAX_HEAP */
+	    if (mem_parse_size(optarg) == 0)
+		app_error("bad heap size for -m");
+	    mem_set_max_heap(mem_parse_size(optarg));
+	    break;
+	case 'S': /* Save a checkpoint before request <op> of each trace */
+	    save_op = atoi(optarg);
+	    break;
+	case 'A': /* Time a warm restart from a heap kept in <file> */
+	    heap_file = strdup(optarg);
+	    break;
+	case 'M': /* Stress a heap shared by up to <n> processes */
+	    shared_procs = atoi(optarg);
+	    break;
+	case 'P': /* Benchmark <n> producer/consumer thread pairs */
+	    pipe_pairs = atoi(optarg);
+	    break;
+	case 'T': /* Replay threaded traces on up to <n> threads */
+	    if ((replay_threads = atoi(optarg)) < 1)
+		app_error("bad number of threads for -T");
+	    break;
+	case 'W': /* Benchmark <n> threads writing to their own blocks */
+	    writers = atoi(optarg);
+	    break;
+	case 'R': /* Resume from a checkpoint and run only the rest */
+	    resume = strdup(optarg);
+	    num_tracefiles = 1;
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -237,7 +561,11 @@ int main(int argc, char **argv)
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
      */
-    if (tracefiles == NULL) {
+    if (resume != NULL) {
+	run_libc = 0; /* libc can only run whole traces */
+	tracefiles = NULL;
+    }
+    else if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
 	printf("Using default tracefiles in %s\n", tracedir);
@@ -246,6 +574,22 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    if (class_bench) {
+	eval_size_class();
+	exit(0);
+    }
+
+    if (convert) {
+	if (resume != NULL)
+	    app_error("-C converts trace files, not checkpoints");
+	for (i = 0; i < num_tracefiles; i++)
+	    convert_trace(tracedir, tracefiles[i]);
+	exit(0);
+    }
+
+    if (stream && (resume != NULL || save_op >= 0 || run_libc))
+	app_error("-s replays whole traces with mm malloc only; drop -R, -S and -l");
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -281,24 +625,94 @@ int main(int argc, char **argv)
 	}
     }
 
+    mem_set_prefault(prefault, pf_ahead);
+
+    /*
+     * The shared heap and thread benchmarks replace the usual mm evaluation
+     */
+    if (heap_file != NULL) {
+	printf("\nWarm restart from heap file %s:\n", heap_file);
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_reopen(trace, i, heap_file);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+    if (shared_procs > 0) {
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_shared(trace, i, shared_procs);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+    if (pipe_pairs > 0) {
+	huge_pages ? mem_init_huge() : mem_init();
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_pipeline(trace, i, pipe_pairs);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+    if (writers > 0) {
+	huge_pages ? mem_init_huge() : mem_init();
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_writers(trace, i, writers);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+    if (replay_threads > 0) {
+	huge_pages ? mem_init_huge() : mem_init();
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_threads(trace, i, replay_threads);
+	    free_trace(trace);
+	}
+	exit(0);
+    }
+
     /*
      * Always run and evaluate the student's mm package
      */
     if (verbose > 1)
 	printf("\nTesting mm malloc\n");
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
+    /* 
+     * Allocate the mm stats array, with one stats_t struct per
+     * tracefile, in memory shared with the workers if there are any
+     */
+    if (njobs > 1) {
+	mm_stats = mmap(NULL, num_tracefiles * sizeof(stats_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mm_stats == MAP_FAILED)
+	    unix_error("mm_stats mmap in main failed");
+    }
+    else if ((mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    huge_pages ? mem_init_huge() : mem_init();
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+    /* 
+     * Evaluate student's mm malloc package using the K-best scheme,
+     * in njobs worker processes with -j
+     */
+    if (njobs > 1)
+	jobs_start(njobs, serial_timing);
+    for (i = jobs_next(-1); i < num_tracefiles; i = jobs_next(i)) {
+	if (stream) {
+	    eval_mm_stream(tracedir, tracefiles[i], i, &ranges, &mm_stats[i]);
+	    continue;
+	}
+	if (resume != NULL)
+	    trace = load_checkpoint(resume);
+	else
+	    trace = read_trace(tracedir, tracefiles[i]);
+	mm_stats[i].ops = trace->num_ops - trace->first_op;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
@@ -310,10 +724,23 @@ int main(int argc, char **argv)
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    jobs_timing(1);
+
+	    /* When resuming, only the requests after the checkpoint count */
+	    if (trace->ckpt != NULL)
+		mm_stats[i].secs = fsecs_setup(eval_mm_restore, eval_mm_replay, 
+					       &speed_params);
+	    else
+		mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (count_dtlb)
+		mm_stats[i].dtlb = dtlb_misses(eval_mm_speed, &speed_params);
+	    jobs_timing(0);
+	    if (save_op >= 0)
+		save_checkpoint(trace, tracefiles ? tracefiles[i] : NULL, save_op);
 	}
 	free_trace(trace);
     }
+    jobs_done();
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -321,6 +748,8 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (count_dtlb)
+	printdtlb(num_tracefiles, mm_stats);
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -341,7 +770,13 @@ int main(int argc, char **argv)
     /* 
      * Compute and print the performance index 
      */
-    if (errors == 0) {
+    if (errors == 0 && secs <= 0) {
+	/* Too quick for the timer, e.g. a short tail after -R */
+	p1 = UTIL_WEIGHT * avg_mm_util;
+	perfindex = p1*100.0;
+	printf("Perf index = %.0f (util) + n/a (thru) = n/a\n", p1*100);
+    }
+    else if (errors == 0) {
 	avg_mm_throughput = ops/secs;
 
 	p1 = UTIL_WEIGHT * avg_mm_util;
@@ -375,22 +810,24 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+static range_t *range_pool;  /* unused range records, linked by child[0] */
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred, *succ;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -412,27 +849,42 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. The payloads in
+     * the tree are disjoint, so it is enough to check the last one that
+     * starts at or below lo and the first one that starts above it.
+     */
+    pred = succ = NULL;
+    for (p = *ranges;  p != NULL;  ) {
+	if (p->lo <= lo) {
+	    pred = p;
+	    p = p->child[1];
+	}
+	else {
+	    succ = p;
+	    p = p->child[0];
+	}
+    }
+    p = NULL;
+    if (pred != NULL && pred->hi >= lo)
+	p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+	p = succ;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it the tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_alloc();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -440,35 +892,125 @@ static int add_range(range_t **ranges, char *lo, int size,
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
+{
+    *ranges = range_delete(*ranges, lo);
+}
+
+/*
+ * clear_ranges - give all of the range records for a trace back to
+ *     the pool
+ */
+static void clear_ranges(range_t **ranges)
+{
+    range_t *p = *ranges;
+
+    if (p == NULL)
+	return;
+    clear_ranges(&p->child[0]);
+    clear_ranges(&p->child[1]);
+    p->child[0] = range_pool;
+    range_pool = p;
+    *ranges = NULL;
+}
+
+/*
+ * range_alloc - take a range record from the pool, refilling it with
+ *     RANGE_SLAB records at a time. The records are never freed.
+ */
+static range_t *range_alloc(void)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    //    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-	    //            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    int i;
+
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_SLAB * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in range_alloc");
+	for (i = 0; i < RANGE_SLAB; i++) {
+	    p[i].child[0] = range_pool;
+	    range_pool = &p[i];
+	}
     }
+    p = range_pool;
+    range_pool = p->child[0];
+    return p;
 }
 
+#define RANGE_HEIGHT(p) ((p) == NULL ? 0 : (p)->height)
+
 /*
- * clear_ranges - free all of the range records for a trace 
+ * range_balance - recompute the height of subtree p after one of its
+ *     children changed by at most one level, rotating it back into
+ *     AVL shape if needed. Returns the new root of the subtree.
  */
-static void clear_ranges(range_t **ranges)
+static range_t *range_balance(range_t *p)
+{
+    range_t *c, *g;
+    int d, hl, hr;
+
+    hl = RANGE_HEIGHT(p->child[0]);
+    hr = RANGE_HEIGHT(p->child[1]);
+    if (hl - hr < 2 && hr - hl < 2) {
+	p->height = (hl > hr ? hl : hr) + 1;
+	return p;
+    }
+
+    /* d is the taller side; a zig-zag first turns c into a straight line */
+    d = (hr > hl);
+    c = p->child[d];
+    if (RANGE_HEIGHT(c->child[!d]) > RANGE_HEIGHT(c->child[d])) {
+	g = c->child[!d];
+	c->child[!d] = g->child[d];
+	g->child[d] = c;
+	range_balance(c);
+	c = range_balance(g);
+    }
+    p->child[d] = c->child[!d];
+    c->child[!d] = range_balance(p);
+    return range_balance(c);
+}
+
+/*
+ * range_insert - add record p to tree t, returning the new root
+ */
+static range_t *range_insert(range_t *t, range_t *p)
+{
+    if (t == NULL) {
+	p->child[0] = p->child[1] = NULL;
+	p->height = 1;
+	return p;
+    }
+    t->child[p->lo > t->lo] = range_insert(t->child[p->lo > t->lo], p);
+    return range_balance(t);
+}
+
+/*
+ * range_delete - remove the record whose payload starts at lo from
+ *     tree t, if there is one, and return the new root
+ */
+static range_t *range_delete(range_t *t, char *lo)
 {
     range_t *p;
-    range_t *pnext;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (t == NULL)
+	return NULL;
+    if (lo != t->lo) {
+	t->child[lo > t->lo] = range_delete(t->child[lo > t->lo], lo);
+	return range_balance(t);
     }
-    *ranges = NULL;
+
+    /* With two children, t takes over the extent of its successor */
+    if (t->child[0] != NULL && t->child[1] != NULL) {
+	for (p = t->child[1]; p->child[0] != NULL; p = p->child[0])
+	    ;
+	t->lo = p->lo;
+	t->hi = p->hi;
+	t->child[1] = range_delete(t->child[1], p->lo);
+	return range_balance(t);
+    }
+    p = t->child[t->child[0] == NULL];
+    t->child[0] = range_pool;
+    range_pool = t;
+    return p;
 }
 
 
@@ -477,139 +1019,1194 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A .rep is
+ *     read from its .rpb cache if that is up to date, and the cache is
+ *     (re)written otherwise, if the directory lets us.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    char *cache;
+    struct stat st;
+    struct timespec t0, t1;
+    double secs;
+    size_t len;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
+    if (stat(path, &st) < 0) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+    len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".rpb") == 0) {
+	if ((trace = read_rpb(path, NULL)) == NULL) {
+	    sprintf(msg, "Tracefile %s is not a valid .rpb file", path);
+	    app_error(msg);
+	}
+    }
+    else {
+	cache = rpb_path(path);
+	if ((trace = read_rpb(cache, &st)) == NULL) {
+	    trace = read_rep(path, &st);
+	    if (trace->tids == NULL && trace->barriers == NULL)
+		write_rpb(trace, cache, &st);
+	}
+	else if (stat(cache, &st) < 0)
+	    unix_error("stat failed in read_trace");
+	free(cache);
+    }
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (verbose > 1)
+	printf("Read %d requests in %.3f secs (%.1f MB/s)\n", trace->num_ops, secs,
+	       st.st_size / 1e6 / (secs > 0 ? secs : 1e-9));
+    return trace;
+}
 
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
+/*
+ * read_rep - parse the text trace at path, whose stat is st
+ */
+static trace_t *read_rep(char *path, struct stat *st)
+{
+    int fd;
+    trace_t *trace;
+    char *map, *p, *end;
+    long header[4], index, size, tid;
+    int type, k;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    /* Map the whole trace file and read its header */
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (st->st_size == 0 ||
+	(map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	unix_error(msg);
+    }
+    close(fd);
+    madvise(map, st->st_size, MADV_SEQUENTIAL);
+    p = map;
+    end = map + st->st_size;
+
+    for (k = 0; k < 4; k++) {
+	if ((header[k] = trace_uint(&p, end)) < 0) {
+	    sprintf(msg, "Tracefile %s has a bad header", path);
+	    app_error(msg);
+	}
+    }
+    trace = new_trace(header, path);
     
     /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
+    for (op_index = 0; ; ) {
+	while (p < end && IS_SPACE(*p))
+	    p++;
+	if (p == end)
+	    break;
+	type = *p;
+	while (p < end && !IS_SPACE(*p))  /* the rest of the type word */
+	    p++;
+	if (type == 'b') {
+	    add_barrier(trace, op_index);
+	    continue;
+	}
+	if (op_index == trace->num_ops) {
+	    sprintf(msg, "Tracefile %s has more than the %d requests in its header",
+		    path, trace->num_ops);
+	    app_error(msg);
+	}
+
+	index = trace_uint(&p, end);
+	size = 0;
+	switch(type) {
 	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    size = trace_uint(&p, end);
 	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    size = trace_uint(&p, end);
 	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
-	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
+		   type, path);
 	    exit(1);
 	}
+	if ((tid = trace_uint(&p, end)) < 0)  /* the thread column is optional */
+	    tid = 0;
+	if (index < 0 || size < 0 || index >= trace->num_ids || tid >= MAX_THREADS) {
+	    sprintf(msg, "Bad request on line %d of tracefile %s",
+		    LINENUM(op_index), path);
+	    app_error(msg);
+	}
+	if (tid > 0)
+	    set_tid(trace, op_index, tid);
+	trace->ops[op_index].index = index;
+	trace->ops[op_index].size = size;
+	if (type != 'f')
+	    max_index = ((unsigned)index > max_index) ? index : max_index;
 	op_index++;
-	
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
+    munmap(map, st->st_size);
+    if (op_index != trace->num_ops || max_index != trace->num_ids - 1) {
+	sprintf(msg, "Tracefile %s has %u requests and %u ids, its header says %d and %d",
+		path, op_index, max_index + 1, trace->num_ops, trace->num_ids);
+	app_error(msg);
+    }
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * read_rpb - load the binary trace at path. If rep is not NULL, the
+ *     file is a cache that must have been made from a .rep with rep's
+ *     mtime and size. Returns NULL if there is no such file or it is
+ *     stale, damaged or not a .rpb at all.
  */
-void free_trace(trace_t *trace)
+static trace_t *read_rpb(char *path, struct stat *rep)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
+    int fd;
+    struct stat st;
+    rpb_hdr_t *hdr;
+    trace_t *trace = NULL;
+    unsigned char *map, *p, *end;
+    unsigned long long v;
+    long header[4];
+    int i;
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(rpb_hdr_t) ||
+	(map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+	close(fd);
+	return NULL;
+    }
+    close(fd);
+    hdr = (rpb_hdr_t *)map;
+    p = map + sizeof(rpb_hdr_t);
+    end = map + st.st_size;
+    if (hdr->magic != RPB_MAGIC || hdr->ops_size != end - p ||
+	(rep != NULL && (hdr->rep_size != rep->st_size ||
+			 hdr->rep_mtime != rep->st_mtim.tv_sec * 1000000000LL +
+			 rep->st_mtim.tv_nsec)) ||
+	hdr->num_ids < 0 || hdr->num_ids > MAX_IDS || hdr->num_ops < 0 ||
+	rpb_hash(RPB_HASH_INIT, p, end - p) != hdr->checksum)
+	goto out;
+
+    header[0] = hdr->sugg_heapsize;
+    header[1] = hdr->num_ids;
+    header[2] = hdr->num_ops;
+    header[3] = hdr->weight;
+    trace = new_trace(header, path);
+
+    /* Unpack the requests */
+    for (i = 0; i < trace->num_ops; i++) {
+	if (rpb_varint(&p, end, &v) < 0 ||
+	    (v >> 2) >= (unsigned)trace->num_ids || (v & 3) > REALLOC)
+	    break;
+	trace->ops[i].type = v & 3;
+	trace->ops[i].index = v >> 2;
+	trace->ops[i].size = 0;
+	if ((v & 3) != FREE) {
+	    if (rpb_varint(&p, end, &v) < 0 || v > INT_MAX)
+		break;
+	    trace->ops[i].size = v;
+	}
+    }
+    if (i != trace->num_ops || p != end) {
+	free_trace(trace);
+	trace = NULL;
+    }
+ out:
+    munmap(map, st.st_size);
+    return trace;
+}
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * write_rpb - save trace as a .rpb file at path, made from the .rep
+ *     whose stat is rep (NULL if none). The file appears under its name
+ *     only once complete. Returns -1 if it cannot be written.
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int write_rpb(trace_t *trace, char *path, struct stat *rep)
 {
-    int i, j;
-    int index;
-    int size;
-    int oldsize;
-    char *newp;
-    char *oldp;
-    char *p;
-    
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
-    clear_ranges(ranges);
+    rpb_hdr_t hdr;
+    unsigned char *buf, *p;
+    unsigned long long v;
+    char tmp[MAXLINE + 16];
+    int i, k, fd, ok;
+
+    /* Two varints take at most 5 + 5 bytes per request */
+    if ((buf = malloc((size_t)trace->num_ops * 10 + 1)) == NULL)
+	unix_error("malloc failed in write_rpb");
+    p = buf;
+    for (i = 0; i < trace->num_ops; i++) {
+	for (k = 0; k < 2; k++) {
+	    if (k == 0)
+		v = (unsigned long long)trace->ops[i].index << 2 | trace->ops[i].type;
+	    else if (trace->ops[i].type != FREE)
+		v = trace->ops[i].size;
+	    else
+		break;
+	    for (; v >= 0x80; v >>= 7)
+		*p++ = (v & 0x7f) | 0x80;
+	    *p++ = v;
+	}
+    }
 
-    /* Call the mm package's init function */
-    if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
-	return 0;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = RPB_MAGIC;
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    hdr.checksum = rpb_hash(RPB_HASH_INIT, buf, p - buf);
+    if (rep != NULL) {
+	hdr.rep_mtime = rep->st_mtim.tv_sec * 1000000000LL + rep->st_mtim.tv_nsec;
+	hdr.rep_size = rep->st_size;
     }
+    hdr.ops_size = p - buf;
 
-    /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    sprintf(tmp, "%s.%d", path, (int)getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	free(buf);
+	return -1;
+    }
+    ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+	write(fd, buf, p - buf) == p - buf;
+    ok = (close(fd) == 0) && ok && rename(tmp, path) == 0;
+    if (!ok)
+	unlink(tmp);
+    free(buf);
+    return ok ? 0 : -1;
+}
 
-        switch (trace->ops[i].type) {
+/*
+ * new_trace - allocate a trace record for the header numbers
+ *     sugg_heapsize, num_ids, num_ops and weight of the trace at path
+ */
+static trace_t *new_trace(long header[4], char *path)
+{
+    trace_t *trace;
 
-        case ALLOC: /* mm_malloc */
+    if (header[1] > MAX_IDS) {
+	sprintf(msg, "Tracefile %s has more than %d ids", path, MAX_IDS);
+	app_error(msg);
+    }
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+    trace->sugg_heapsize = header[0]; /* not used */
+    trace->num_ids = header[1];
+    trace->num_ops = header[2];
+    trace->weight = header[3];        /* not used */
+    trace->first_op = 0;
+    trace->ckpt = NULL;
+    trace->ckpt_size = 0;
+    trace->tids = NULL;
+    trace->num_threads = 1;
+    trace->barriers = NULL;
+    trace->num_barriers = 0;
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+    return trace;
+}
+
+/*
+ * trace_uint - Parse the unsigned decimal number at *pp, after the
+ *     white space in front of it, and move *pp past it. Returns -1 if
+ *     there is no number before end or it does not fit in an int.
+ */
+static long trace_uint(char **pp, char *end)
+{
+    char *p = *pp;
+    long n;
+    int d;
+
+    while (p < end && IS_SPACE(*p))
+	p++;
+    if (p == end || !IS_DIGIT(*p))
+	return -1;
+    for (n = 0; p < end && IS_DIGIT(*p); p++) {
+	d = *p - '0';
+	if (n > (INT_MAX - d) / 10)
+	    return -1;
+	n = 10 * n + d;
+    }
+    *pp = p;
+    return n;
+}
+
+/*
+ * set_tid - Put request opnum of a trace on thread tid. The thread
+ *     array is only allocated for traces with a thread column.
+ */
+static void set_tid(trace_t *trace, int opnum, int tid)
+{
+    if (trace->tids == NULL &&
+	(trace->tids = calloc(trace->num_ops, sizeof(unsigned char))) == NULL)
+	unix_error("calloc failed in set_tid");
+    trace->tids[opnum] = tid;
+    if (tid >= trace->num_threads)
+	trace->num_threads = tid + 1;
+}
+
+/*
+ * add_barrier - Record a barrier ("b" line) in front of request opnum
+ */
+static void add_barrier(trace_t *trace, int opnum)
+{
+    int n = trace->num_barriers;
+
+    /* The array grows whenever its size reaches a power of two */
+    if ((n & (n - 1)) == 0 &&
+	(trace->barriers = realloc(trace->barriers, (n ? 2 * n : 1) * sizeof(int))) == NULL)
+	unix_error("realloc failed in add_barrier");
+    trace->barriers[trace->num_barriers++] = opnum;
+}
+
+/*
+ * convert_trace - write the .rpb file of a .rep trace (mdriver -C)
+ */
+static void convert_trace(char *tracedir, char *filename)
+{
+    trace_t *trace;
+    char path[MAXLINE];
+    char *cache;
+    struct stat st, cst;
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if (stat(path, &st) < 0) {
+	sprintf(msg, "Could not open %s in convert_trace", path);
+	unix_error(msg);
+    }
+    trace = read_rep(path, &st);
+    if (trace->tids != NULL || trace->barriers != NULL) {
+	sprintf(msg, "Tracefile %s has threads, which .rpb files do not hold", path);
+	app_error(msg);
+    }
+    cache = rpb_path(path);
+    if (write_rpb(trace, cache, &st) < 0 || stat(cache, &cst) < 0) {
+	sprintf(msg, "Could not write %s", cache);
+	unix_error(msg);
+    }
+    printf("%s: %d requests, %ld bytes as text, %ld as .rpb\n", cache,
+	   trace->num_ops, (long)st.st_size, (long)cst.st_size);
+    free(cache);
+    free_trace(trace);
+}
+
+/*
+ * rpb_path - the name of the .rpb cache of the trace at path, in a
+ *     string the caller frees
+ */
+static char *rpb_path(char *path)
+{
+    size_t len = strlen(path);
+    char *cache;
+
+    if ((cache = malloc(len + 5)) == NULL)
+	unix_error("malloc failed in rpb_path");
+    strcpy(cache, path);
+    if (len > 4 && strcmp(cache + len - 4, ".rep") == 0)
+	cache[len - 4] = '\0';
+    strcat(cache, ".rpb");
+    return cache;
+}
+
+/*
+ * rpb_hash - 32-bit FNV-1a hash of len bytes at p, continuing from h
+ *     (RPB_HASH_INIT to start a new one)
+ */
+static unsigned int rpb_hash(unsigned int h, unsigned char *p, size_t len)
+{
+    while (len-- > 0)
+	h = (h ^ *p++) * 16777619u;
+    return h;
+}
+
+/*
+ * rpb_varint - read the varint at *pp, 7 bits a byte with the low bits
+ *     first, into v and move *pp past it. Returns -1 if it does not end
+ *     before end.
+ */
+static int rpb_varint(unsigned char **pp, unsigned char *end, unsigned long long *v)
+{
+    unsigned char *p = *pp;
+    int shift;
+
+    *v = 0;
+    for (shift = 0; p < end && shift < 64; shift += 7) {
+	*v |= (unsigned long long)(*p & 0x7f) << shift;
+	if (*p++ < 0x80) {
+	    *pp = p;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    free(trace->ops);         /* free the three arrays... */
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace->ckpt);        /* ... any checkpoint image... */
+    free(trace->tids);        /* ... the threads and barriers... */
+    free(trace->barriers);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*****************************************************************
+ * The following routines replay a trace as it is read (-s), so
+ * that traces larger than memory can be run
+ ****************************************************************/
+
+/*
+ * eval_mm_stream - Evaluate mm malloc on a streamed trace: one pass
+ *     checks it for correctness and measures its utilization, and a
+ *     second one, if the first succeeds, times it
+ */
+static void eval_mm_stream(char *tracedir, char *filename, int tracenum,
+			   range_t **ranges, stats_t *stats)
+{
+    stats->dtlb = -1;
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\nChecking mm_malloc for correctness "
+	       "and efficiency, ", filename);
+    stats->valid = stream_pass(tracedir, filename, tracenum, ranges, stats);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("and performance.\n");
+	jobs_timing(1);
+	stream_pass(tracedir, filename, tracenum, NULL, stats);
+	jobs_timing(0);
+    }
+}
+
+/*
+ * stream_pass - Replay the trace once on a fresh heap as it is read.
+ *     With ranges, check each request and set stats->util and
+ *     stats->ops; without, time the requests alone into stats->secs.
+ *     Returns 0 if mm malloc got something wrong.
+ */
+static int stream_pass(char *tracedir, char *filename, int tracenum,
+		       range_t **ranges, stats_t *stats)
+{
+    stream_t *s;
+    chunk_t *chunk;
+    traceop_t *op;
+    idmap_t ids;
+    idslot_t *slot;
+    char *p;
+    int i, j, opnum, size, oldsize, ok = 1;
+    double total_size = 0, max_total_size = 0, secs = 0;
+    struct timespec t0, t1;
+
+    s = stream_open(tracedir, filename);
+    idmap_init(&ids);
+    if (ranges != NULL)
+	clear_ranges(ranges);
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	ok = 0;
+    }
+
+    for (opnum = 0; ok && (chunk = stream_next(s))->n > 0; stream_release(s)) {
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; ok && i < chunk->n; i++, opnum++) {
+	    op = &chunk->ops[i];
+	    size = op->size;
+	    slot = (op->type == ALLOC) ? idmap_insert(&ids, op->index) :
+		idmap_find(&ids, op->index);
+	    if (slot == NULL) {
+		sprintf(msg, "Line %d of tracefile %s uses id %u, which is not allocated",
+			LINENUM(opnum), filename, (unsigned)op->index);
+		app_error(msg);
+	    }
+
+	    switch (op->type) {
+	    case ALLOC:
+		if ((p = mm_malloc(size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_malloc failed.");
+		    ok = 0;
+		    break;
+		}
+		if (ranges != NULL) {
+		    if (add_range(ranges, p, size, tracenum, opnum) == 0) {
+			ok = 0;
+			break;
+		    }
+		    memset(p, op->index & 0xFF, size);
+		    total_size += size;
+		}
+		slot->block = p;
+		slot->size = size;
+		break;
+
+	    case REALLOC:
+		if ((p = mm_realloc(slot->block, size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_realloc failed.");
+		    ok = 0;
+		    break;
+		}
+		if (ranges != NULL) {
+		    remove_range(ranges, slot->block);
+		    if (add_range(ranges, p, size, tracenum, opnum) == 0) {
+			ok = 0;
+			break;
+		    }
+		    oldsize = (size < slot->size) ? size : slot->size;
+		    for (j = 0; j < oldsize; j++) {
+			if (p[j] != (char)(op->index & 0xFF)) {
+			    malloc_error(tracenum, opnum, "mm_realloc did not preserve the "
+					 "data from old block");
+			    ok = 0;
+			    break;
+			}
+		    }
+		    memset(p, op->index & 0xFF, size);
+		    total_size += size - slot->size;
+		}
+		slot->block = p;
+		slot->size = size;
+		break;
+
+	    case FREE:
+		if (ranges != NULL) {
+		    remove_range(ranges, slot->block);
+		    total_size -= slot->size;
+		}
+		mm_free(slot->block);
+		idmap_delete(&ids, slot);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in stream_pass");
+	    }
+	    if (total_size > max_total_size)
+		max_total_size = total_size;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    }
+
+    if (ranges != NULL) {
+	stats->ops = opnum;
+	stats->util = max_total_size / mem_heapsize();
+    }
+    else
+	stats->secs = (secs > 0) ? secs : 1e-9;
+    stream_close(s);
+    free(ids.slot);
+    return ok;
+}
+
+/*
+ * stream_open - Open a trace for streaming and start decoding it. A
+ *     .rep is read from its .rpb cache if that is up to date.
+ */
+static stream_t *stream_open(char *tracedir, char *filename)
+{
+    stream_t *s;
+    struct stat st, cst;
+    rpb_hdr_t hdr;
+    char *cache, *p;
+    long header[4];
+    size_t len;
+    int k, fd;
+
+    if ((s = calloc(1, sizeof(stream_t))) == NULL ||
+	(s->buf = malloc(STREAM_READ)) == NULL ||
+	(s->path = malloc(strlen(tracedir) + strlen(filename) + 1)) == NULL)
+	unix_error("malloc failed in stream_open");
+    strcpy(s->path, tracedir);
+    strcat(s->path, filename);
+    if ((s->fd = open(s->path, O_RDONLY)) < 0 || fstat(s->fd, &st) < 0) {
+	sprintf(msg, "Could not open %s in stream_open", s->path);
+	unix_error(msg);
+    }
+    len = strlen(s->path);
+    s->binary = (len > 4 && strcmp(s->path + len - 4, ".rpb") == 0);
+
+    /* Switch to the cache if it was made from this very .rep */
+    if (!s->binary) {
+	cache = rpb_path(s->path);
+	if ((fd = open(cache, O_RDONLY)) >= 0) {
+	    if (fstat(fd, &cst) == 0 && read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		hdr.magic == RPB_MAGIC && hdr.rep_size == st.st_size &&
+		hdr.rep_mtime == st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec &&
+		hdr.ops_size == cst.st_size - (off_t)sizeof(hdr)) {
+		close(s->fd);
+		s->fd = fd;
+		s->binary = 1;
+		s->len = sizeof(hdr);
+		memcpy(s->buf, &hdr, sizeof(hdr));
+	    }
+	    else
+		close(fd);
+	}
+	free(cache);
+    }
+
+    /* Read the header */
+    if (s->binary) {
+	stream_refill(s, sizeof(hdr));
+	memcpy(&hdr, s->buf, sizeof(hdr));
+	if (s->len < sizeof(hdr) || hdr.magic != RPB_MAGIC ||
+	    hdr.num_ids < 0 || hdr.num_ops < 0) {
+	    sprintf(msg, "Tracefile %s is not a valid .rpb file", s->path);
+	    app_error(msg);
+	}
+	s->num_ids = hdr.num_ids;
+	s->num_ops = hdr.num_ops;
+	s->checksum = hdr.checksum;
+	s->pos = s->hashpos = sizeof(hdr);
+	s->hash = RPB_HASH_INIT;
+    }
+    else {
+	stream_refill(s, STREAM_LINE);
+	p = (char *)s->buf;
+	for (k = 0; k < 4; k++) {
+	    if ((header[k] = trace_uint(&p, (char *)s->buf + s->len)) < 0) {
+		sprintf(msg, "Tracefile %s has a bad header", s->path);
+		app_error(msg);
+	    }
+	}
+	s->num_ids = header[1];
+	s->num_ops = header[2];
+	s->pos = (unsigned char *)p - s->buf;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->decoder, NULL, stream_decoder, s) != 0)
+	unix_error("pthread_create failed in stream_open");
+    return s;
+}
+
+/*
+ * stream_close - Stop the decoder and release the stream
+ */
+static void stream_close(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->decoder, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    close(s->fd);
+    free(s->buf);
+    free(s->path);
+    free(s);
+}
+
+/*
+ * stream_next - Wait for the next chunk of requests. A chunk of none
+ *     means the trace is over.
+ */
+static chunk_t *stream_next(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    while (!s->full[s->next])
+	pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return &s->chunk[s->next];
+}
+
+/*
+ * stream_release - Hand the chunk from stream_next back to the decoder
+ */
+static void stream_release(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->full[s->next] = 0;
+    s->next ^= 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * stream_decoder - Thread that fills the chunks in turn, until the
+ *     end of the trace or until the replay stops
+ */
+static void *stream_decoder(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    int k, n;
+
+    for (k = 0; ; k ^= 1) {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[k] && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	if (s->stop)
+	    break;
+
+	n = stream_decode(s, s->chunk[k].ops);
+	s->chunk[k].n = n;
+	pthread_mutex_lock(&s->lock);
+	s->full[k] = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	if (n == 0)
+	    break;
+    }
+    return NULL;
+}
+
+/*
+ * stream_decode - Decode up to STREAM_CHUNK requests into ops and
+ *     return how many. At the end of the trace, check that it held as
+ *     many requests as its header says and, for a .rpb, its checksum.
+ */
+static int stream_decode(stream_t *s, traceop_t *ops)
+{
+    char *p, *end;
+    unsigned char *q;
+    unsigned long long v;
+    long index, size;
+    int n, type;
+
+    for (n = 0; n < STREAM_CHUNK; n++) {
+	if (s->binary) {
+	    if (s->decoded == s->num_ops)
+		break;
+	    stream_refill(s, 10);
+	    q = s->buf + s->pos;
+	    if (rpb_varint(&q, s->buf + s->len, &v) < 0 || (v & 3) > REALLOC)
+		break;
+	    type = v & 3;
+	    index = v >> 2;
+	    size = 0;
+	    if (type != FREE && (rpb_varint(&q, s->buf + s->len, &v) < 0 || v > INT_MAX))
+		break;
+	    if (type != FREE)
+		size = v;
+	    s->pos = q - s->buf;
+	}
+	else {
+	    /* 
+	     * Skip to the next request, refilling as often as needed.
+	     * Barriers only matter to threaded replay (-T), so they go too.
+	     */
+	    for (;;) {
+		while (s->pos < s->len && IS_SPACE(s->buf[s->pos]))
+		    s->pos++;
+		if (s->pos < s->len && s->buf[s->pos] == 'b') {
+		    stream_refill(s, STREAM_LINE);
+		    while (s->pos < s->len && !IS_SPACE(s->buf[s->pos]))
+			s->pos++;
+		    continue;
+		}
+		if (s->pos < s->len || s->eof)
+		    break;
+		stream_refill(s, 1);
+	    }
+	    if (s->pos == s->len)
+		break;
+	    stream_refill(s, STREAM_LINE);
+	    p = (char *)s->buf + s->pos;
+	    end = (char *)s->buf + s->len;
+	    type = *p;
+	    while (p < end && !IS_SPACE(*p))
+		p++;
+	    index = trace_uint(&p, end);
+	    size = 0;
+	    switch (type) {
+	    case 'a':
+		type = ALLOC;
+		size = trace_uint(&p, end);
+		break;
+	    case 'r':
+		type = REALLOC;
+		size = trace_uint(&p, end);
+		break;
+	    case 'f':
+		type = FREE;
+		break;
+	    default:
+		sprintf(msg, "Bogus type character (%c) in tracefile %s", type, s->path);
+		app_error(msg);
+	    }
+	    trace_uint(&p, end);  /* the thread, if there is a column for it */
+	    s->pos = (unsigned char *)p - s->buf;
+	}
+
+	if (s->decoded == s->num_ops) {
+	    sprintf(msg, "Tracefile %s has more than the %d requests in its header",
+		    s->path, s->num_ops);
+	    app_error(msg);
+	}
+	if (index < 0 || index >= MAX_IDS || size < 0) {
+	    sprintf(msg, "Bad request on line %d of tracefile %s",
+		    LINENUM(s->decoded), s->path);
+	    app_error(msg);
+	}
+	ops[n].type = type;
+	ops[n].index = index;
+	ops[n].size = size;
+	s->decoded++;
+    }
+
+    if (n == 0) {
+	if (s->binary)
+	    s->hash = rpb_hash(s->hash, s->buf + s->hashpos, s->pos - s->hashpos);
+	if (s->binary && (s->decoded != s->num_ops || s->pos != s->len ||
+			  s->hash != s->checksum)) {
+	    sprintf(msg, "Tracefile %s is damaged", s->path);
+	    app_error(msg);
+	}
+	if (s->decoded != s->num_ops) {
+	    sprintf(msg, "Tracefile %s has %d requests, its header says %d",
+		    s->path, s->decoded, s->num_ops);
+	    app_error(msg);
+	}
+    }
+    return n;
+}
+
+/*
+ * stream_refill - Read more of the file unless want bytes past pos are
+ *     there already, moving what is left to the front of the buffer
+ */
+static void stream_refill(stream_t *s, size_t want)
+{
+    ssize_t n;
+
+    if (s->len - s->pos >= want || s->eof)
+	return;
+    if (s->binary)
+	s->hash = rpb_hash(s->hash, s->buf + s->hashpos, s->pos - s->hashpos);
+    memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+    s->len -= s->pos;
+    s->pos = s->hashpos = 0;
+    while (s->len < want && !s->eof) {
+	if ((n = read(s->fd, s->buf + s->len, STREAM_READ - s->len)) < 0)
+	    unix_error("read failed in stream_refill");
+	s->eof = (n == 0);
+	s->len += n;
+    }
+}
+
+/*
+ * idmap_init - Start an empty id table
+ */
+static void idmap_init(idmap_t *map)
+{
+    map->bits = 10;
+    map->count = 0;
+    if ((map->slot = calloc(1 << map->bits, sizeof(idslot_t))) == NULL)
+	unix_error("calloc failed in idmap_init");
+}
+
+/*
+ * idmap_find - The slot of a live block id, NULL if there is none
+ */
+static idslot_t *idmap_find(idmap_t *map, unsigned int id)
+{
+    unsigned int i;
+
+    for (i = IDMAP_HASH(map, id + 1); map->slot[i].key != 0; i = (i + 1) & IDMAP_MASK(map))
+	if (map->slot[i].key == id + 1)
+	    return &map->slot[i];
+    return NULL;
+}
+
+/*
+ * idmap_insert - The slot of block id, taking a new one if it has
+ *     none. The table doubles when it is half full.
+ */
+static idslot_t *idmap_insert(idmap_t *map, unsigned int id)
+{
+    idslot_t *old, *slot;
+    unsigned int i;
+
+    if ((slot = idmap_find(map, id)) != NULL)
+	return slot;
+
+    if (2 * (map->count + 1) > (1u << map->bits)) {
+	old = map->slot;
+	map->bits++;
+	if ((map->slot = calloc(1 << map->bits, sizeof(idslot_t))) == NULL)
+	    unix_error("calloc failed in idmap_insert");
+	for (i = 0; i < (1u << (map->bits - 1)); i++) {
+	    if (old[i].key != 0) {
+		for (slot = &map->slot[IDMAP_HASH(map, old[i].key)]; slot->key != 0;
+		     slot = &map->slot[(slot - map->slot + 1) & IDMAP_MASK(map)])
+		    ;
+		*slot = old[i];
+	    }
+	}
+	free(old);
+    }
+
+    for (i = IDMAP_HASH(map, id + 1); map->slot[i].key != 0; i = (i + 1) & IDMAP_MASK(map))
+	;
+    map->slot[i].key = id + 1;
+    map->slot[i].block = NULL;
+    map->slot[i].size = 0;
+    map->count++;
+    return &map->slot[i];
+}
+
+/*
+ * idmap_delete - Empty a slot, moving later slots of the same probe
+ *     run back so that no lookup stops short of them
+ */
+static void idmap_delete(idmap_t *map, idslot_t *slot)
+{
+    unsigned int hole = slot - map->slot, i, home;
+
+    for (i = (hole + 1) & IDMAP_MASK(map); map->slot[i].key != 0; i = (i + 1) & IDMAP_MASK(map)) {
+	home = IDMAP_HASH(map, map->slot[i].key);
+	/* Move it if its home is not in the cyclic range (hole, i] */
+	if (((i - home) & IDMAP_MASK(map)) >= ((i - hole) & IDMAP_MASK(map))) {
+	    map->slot[hole] = map->slot[i];
+	    hole = i;
+	}
+    }
+    map->slot[hole].key = 0;
+    map->count--;
+}
+
+/*
+ * save_checkpoint - Replay the first opnum requests of a trace on a
+ *     fresh heap and write the allocator state, together with the
+ *     location of every live block, to <trace>-<opnum>.ckpt in the
+ *     current directory. Resume from it with -R.
+ */
+static void save_checkpoint(trace_t *trace, char *filename, int opnum)
+{
+    FILE *fp;
+    ckpt_hdr_t hdr;
+    ckpt_block_t blk;
+    char path[MAXLINE];
+    char *base;
+    int i, index;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (trace->ckpt != NULL)
+	strcpy(hdr.tracepath, ((ckpt_hdr_t *)trace->ckpt)->tracepath);
+    else {
+	strcpy(hdr.tracepath, tracedir);
+	strcat(hdr.tracepath, filename);
+    }
+
+    if (opnum < trace->first_op || opnum > trace->num_ops) {
+	printf("Not saving checkpoint: requests %d to %d only\n",
+	       trace->first_op, trace->num_ops);
+	return;
+    }
+
+    /* Rebuild the heap as it stands just before request opnum */
+    start_mm_trace(trace);
+    if (trace->ckpt == NULL)
+	memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    for (i = trace->first_op;  i < opnum;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((trace->blocks[index] = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in save_checkpoint");
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    if ((trace->blocks[index] = mm_realloc(trace->blocks[index],
+						   trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in save_checkpoint");
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    break;
+	}
+    }
+
+    /* Checkpoints go in the current directory, named after the trace */
+    base = strrchr(hdr.tracepath, '/') ? 
+	strrchr(hdr.tracepath, '/') + 1 : hdr.tracepath;
+    snprintf(path, sizeof(path), "%s-%d.ckpt", base, opnum);
+    if ((fp = fopen(path, "w")) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not open %.512s in save_checkpoint", path);
+	unix_error(msg);
+    }
+
+    hdr.magic = CKPT_MAGIC;
+    hdr.opnum = opnum;
+    hdr.num_ids = trace->num_ids;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for (i = 0; i < trace->num_ids; i++) {
+	blk.offset = trace->blocks[i] ? 
+	    trace->blocks[i] - (char *)mem_heap_lo() : -1;
+	blk.size = trace->blocks[i] ? trace->block_sizes[i] : 0;
+	fwrite(&blk, sizeof(blk), 1, fp);
+    }
+    if (mm_snapshot(fp) < 0 || fclose(fp) != 0)
+	unix_error("Could not write checkpoint in save_checkpoint");
+    printf("Saved checkpoint before request %d of %s to %s\n", 
+	   opnum, hdr.tracepath, path);
+}
+
+/*
+ * load_checkpoint - Read a checkpoint written by -S and the trace it was
+ *     taken from. The trace is set up to start at the checkpointed request.
+ */
+static trace_t *load_checkpoint(char *filename)
+{
+    FILE *fp;
+    trace_t *trace;
+    ckpt_hdr_t *hdr;
+    char *buf;
+    long size;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not open %.512s in load_checkpoint", filename);
+	unix_error(msg);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if ((buf = malloc(size)) == NULL)
+	unix_error("malloc failed in load_checkpoint");
+    if (fread(buf, 1, size, fp) != size)
+	unix_error("Could not read checkpoint in load_checkpoint");
+    fclose(fp);
+
+    hdr = (ckpt_hdr_t *)buf;
+    if (size < sizeof(ckpt_hdr_t) || hdr->magic != CKPT_MAGIC) {
+	snprintf(msg, sizeof(msg), "%.512s is not a checkpoint file", filename);
+	app_error(msg);
+    }
+
+    trace = read_trace("", hdr->tracepath);
+    if (trace->num_ids != hdr->num_ids || trace->num_ops < hdr->opnum) {
+	snprintf(msg, sizeof(msg), "%.400s does not match checkpoint %.400s",
+		hdr->tracepath, filename);
+	app_error(msg);
+    }
+    if (verbose > 1)
+	printf("Resuming %s at request %d\n", hdr->tracepath, hdr->opnum);
+    trace->first_op = hdr->opnum;
+    trace->ckpt = buf;
+    trace->ckpt_size = size;
+    return trace;
+}
+
+/*
+ * start_mm_trace - Get the mm package ready to run a trace: an empty
+ *     heap from mm_reset, or, when resuming, the checkpointed heap with
+ *     its live blocks filled back into the trace's block arrays. The
+ *     heap was set up by mm_init in eval_mm_valid, so mm_reset is
+ *     enough here and keeps the setup out of the timed passes.
+ */
+static void start_mm_trace(trace_t *trace)
+{
+    ckpt_block_t *blk;
+    FILE *fp;
+    int i;
+
+    if (trace->ckpt == NULL) {
+	if (mm_reset() < 0)
+	    app_error("mm_reset failed.");
+	return;
+    }
+
+    blk = (ckpt_block_t *)(trace->ckpt + sizeof(ckpt_hdr_t));
+    fp = fmemopen(blk + trace->num_ids, trace->ckpt_size - 
+		  sizeof(ckpt_hdr_t) - trace->num_ids * sizeof(ckpt_block_t),
+		  "r");
+    if (fp == NULL || mm_restore(fp) < 0)
+	app_error("mm_restore failed.");
+    fclose(fp);
+
+    for (i = 0; i < trace->num_ids; i++) {
+	trace->blocks[i] = (blk[i].offset < 0) ? NULL :
+	    (char *)mem_heap_lo() + blk[i].offset;
+	trace->block_sizes[i] = blk[i].size;
+    }
+}
+
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
+
+/*
+ * eval_mm_valid - Check the mm malloc package for correctness
+ */
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+{
+    int i, j;
+    int index;
+    int size;
+    int oldsize;
+    char *newp;
+    char *oldp;
+    char *p;
+    
+    /* Reset the heap and free any records in the range list */
+    clear_ranges(ranges);
+
+    /* Call the mm package's init function, or restore the checkpoint */
+    if (trace->ckpt == NULL) {
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    malloc_error(tracenum, 0, "mm_init failed.");
+	    return 0;
+	}
+    }
+    else {
+	start_mm_trace(trace);
+	for (i = 0;  i < trace->num_ids;  i++)
+	    if (trace->blocks[i] != NULL &&
+		add_range(ranges, trace->blocks[i], trace->block_sizes[i],
+			  tracenum, trace->first_op) == 0)
+		return 0;
+    }
+
+    /* Interpret each operation in the trace in order */
+    for (i = trace->first_op;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
 	    if ((p = mm_malloc(size)) == NULL) {
@@ -714,11 +2311,17 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
-	app_error("mm_init failed in eval_mm_util");
+    start_mm_trace(trace);
+
+    /* Blocks that are live at a checkpoint count from the start */
+    if (trace->ckpt != NULL) {
+	for (i = 0;  i < trace->num_ids;  i++)
+	    if (trace->blocks[i] != NULL)
+		total_size += trace->block_sizes[i];
+	max_total_size = total_size;
+    }
 
-    for (i = 0;  i < trace->num_ops;  i++) {
+    for (i = trace->first_op;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
@@ -791,25 +2394,32 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
+{
+    /* Reset the heap and initialize the mm package */
+    start_mm_trace(((speed_t *)ptr)->trace);
+
+    eval_mm_replay(ptr);
+}
+
+/*
+ * eval_mm_replay - Run the trace requests on the heap as it is, 
+ *    without checking the results.
+ */
+static void eval_mm_replay(void *ptr)
 {
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
-	app_error("mm_init failed in eval_mm_speed");
-
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = trace->first_op;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
             if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
+		app_error("mm_malloc error in eval_mm_replay");
             trace->blocks[index] = p;
             break;
 
@@ -818,7 +2428,7 @@ static void eval_mm_speed(void *ptr)
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
+		app_error("mm_realloc error in eval_mm_replay");
             trace->blocks[index] = newp;
             break;
 
@@ -833,6 +2443,765 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_restore - Restore the checkpoint before each timed replay of
+ *    the rest of the trace, outside the timing.
+ */
+static void eval_mm_restore(void *ptr)
+{
+    start_mm_trace(((speed_t *)ptr)->trace);
+}
+
+/*
+ * jobs_start - Fork njobs workers to evaluate the traces (-j). Each
+ *    worker is pinned to a CPU of its own when there are enough of
+ *    them, and returns to go through the traces with jobs_next. The
+ *    driver returns once all the workers are done.
+ */
+static void jobs_start(int njobs, int serial)
+{
+    pthread_mutexattr_t attr;
+    cpu_set_t cpus, one;
+    int w, cpu, status;
+    pid_t pid;
+
+    jobs = mmap(NULL, sizeof(jobs_t), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (jobs == MAP_FAILED)
+	unix_error("mmap failed in jobs_start");
+    jobs->serial = serial;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&jobs->timing, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
+	CPU_ZERO(&cpus);
+    fflush(stdout);
+
+    for (w = 0, cpu = 0; w < njobs; w++, cpu++) {
+	while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &cpus))
+	    cpu++;
+	if ((pid = fork()) < 0)
+	    unix_error("fork failed in jobs_start");
+	if (pid == 0) {
+	    worker = w;
+	    if (CPU_COUNT(&cpus) >= njobs) {
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		sched_setaffinity(0, sizeof(one), &one);
+	    }
+	    return;
+	}
+    }
+
+    while (wait(&status) > 0) {
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    printf("ERROR: a worker process failed\n");
+	    errors++;
+	}
+    }
+    errors += jobs->errors;
+}
+
+/*
+ * jobs_next - The trace to evaluate after tracenum (-1 for the first).
+ *    With -j, that is the next one no worker has taken yet, and there
+ *    is none for the driver.
+ */
+static int jobs_next(int tracenum)
+{
+    if (jobs == NULL)
+	return tracenum + 1;
+    if (worker < 0)
+	return INT_MAX;
+    return __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * jobs_timing - Start or end timing a trace. With -X, this keeps the
+ *    other workers from timing meanwhile, though they may check theirs.
+ */
+static void jobs_timing(int start)
+{
+    if (jobs == NULL || !jobs->serial)
+	return;
+    if (start)
+	pthread_mutex_lock(&jobs->timing);
+    else
+	pthread_mutex_unlock(&jobs->timing);
+}
+
+/*
+ * jobs_done - Report a worker's errors to the driver and exit
+ */
+static void jobs_done(void)
+{
+    if (worker < 0)
+	return;
+    __atomic_fetch_add(&jobs->errors, errors, __ATOMIC_RELAXED);
+    exit(0);
+}
+
+/*
+ * eval_mm_reopen - Time a warm restart from a heap file (-A). The first
+ *    half of the trace runs on a new heap in path, which is then closed,
+ *    and reopening it with mem_init_file and mm_attach is timed against
+ *    running those requests again. The second half then runs on the
+ *    reopened heap, which must still hold every block of the first.
+ */
+static void eval_mm_reopen(trace_t *trace, int tracenum, char *path)
+{
+    speed_t speed_params;
+    struct timespec t0, t1;
+    double replay, reopen;
+    int num_ops = trace->num_ops;
+    size_t heapsize;
+    void *base;
+
+    speed_params.trace = trace;
+    unlink(path);
+    if (mem_init_file(path, NULL) != 0 || mm_init() < 0)
+	app_error("could not create a heap file in eval_mm_reopen");
+    trace->num_ops = num_ops / 2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    eval_mm_replay(&speed_params);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    replay = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+    base = mem_heap_lo();
+    heapsize = mem_heapsize();
+    mem_deinit();
+
+    /* Reopen it where it was, so that the block pointers still hold */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (mem_init_file(path, base) != 1 || mm_attach() < 0)
+	app_error("could not reopen the heap file in eval_mm_reopen");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    reopen = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+    if (mem_heap_lo() != base)
+	app_error("the heap file was reopened at another address in eval_mm_reopen");
+
+    trace->first_op = trace->num_ops;
+    trace->num_ops = num_ops;
+    eval_mm_replay(&speed_params);
+    trace->first_op = 0;
+    mem_deinit();
+    unlink(path);
+
+    printf("Trace %d: %d requests in %.3f ms, reopening their %lu KB heap "
+	   "in %.3f ms (%.0fx)\n", tracenum, num_ops / 2, replay * 1e3,
+	   (unsigned long)(heapsize / 1024), reopen * 1e3, replay / reopen);
+}
+
+/*
+ * eval_mm_shared - Stress test a heap in shared memory. For 1, 2, 4, ...
+ *    nprocs processes, each process maps the heap (at an address of its
+ *    own) and all of them replay the trace against it at the same time.
+ *    The aggregate throughput shows how much they contend for the heap.
+ *    The heap is made big enough for SHARED_SLACK times the peak payload
+ *    of the trace in each process; a worker that still runs out of it
+ *    exits with SHARED_NOMEM.
+ */
+#define SHARED_SLACK 2
+#define SHARED_NOMEM 2
+
+static void eval_mm_shared(trace_t *trace, int tracenum, int nprocs)
+{
+    char name[MAXLINE];
+    int go[2], res[2];
+    int i, p, status, failed, nomem;
+    speed_t speed_params;
+    double total, peak;
+    size_t need;
+    char *live;
+    double secs, maxsecs;
+    void *old, *hole;
+    size_t size;
+    pid_t pid;
+
+    sprintf(name, "/mdriver.%d", (int)getpid());
+    speed_params.trace = trace;
+
+    /* Find the blocks the trace leaves allocated, to free between runs */
+    if ((live = calloc(trace->num_ids, 1)) == NULL ||
+	(speed_params.live = malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_shared");
+    for (i = 0, total = peak = 0; i < trace->num_ops; i++) {
+	live[trace->ops[i].index] = (trace->ops[i].type != FREE);
+	if (trace->ops[i].type != ALLOC)  /* a realloc frees its old size */
+	    total -= trace->block_sizes[trace->ops[i].index];
+	if (trace->ops[i].type != FREE)
+	    total += (trace->block_sizes[trace->ops[i].index] = trace->ops[i].size);
+	peak = (total > peak) ? total : peak;
+    }
+    for (i = 0, speed_params.nlive = 0; i < trace->num_ids; i++)
+	if (live[i])
+	    speed_params.live[speed_params.nlive++] = i;
+    free(live);
+    printf("\nShared heap stress test, trace %d:\n%6s%10s%10s%10s\n",
+	   tracenum, "procs", "secs", "Kops", "Kops/proc");
+
+    for (p = 1; ; p = (2*p < nprocs) ? 2*p : nprocs) {
+	mem_init_shared(name);
+	need = SHARED_SLACK * p * peak + (1 << 20);
+	if (mem_maxheapsize() < need) {
+	    mem_deinit();
+	    mem_set_max_heap(need);
+	    mem_init_shared(name);
+	}
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_shared");
+	if (pipe(go) < 0 || pipe(res) < 0)
+	    unix_error("pipe failed in eval_mm_shared");
+	fflush(stdout);
+
+	for (i = 0; i < p; i++) {
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_mm_shared");
+	    if (pid > 0)
+		continue;
+
+	    /* 
+	     * Map the heap again, holding the old range so it can't be
+	     * reused, so that each worker sees it at a new address.
+	     */
+	    close(go[1]);
+	    close(res[0]);
+	    old = mem_heap_lo();
+	    size = mem_maxheapsize();
+	    mem_deinit();
+	    hole = mmap(old, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	    mem_init_shared(name);
+	    if (hole != MAP_FAILED)
+		munmap(hole, size);
+	    if (mm_attach() < 0)
+		app_error("mm_attach failed in eval_mm_shared");
+
+	    /* Wait until every worker is ready, then go */
+	    if (read(go[0], &status, 1) != 1)
+		exit(1);
+	    secs = ftimer_gettod(shared_round, &speed_params, 10);
+	    if (write(res[1], &secs, sizeof(secs)) != sizeof(secs))
+		exit(1);
+	    exit(0);
+	}
+
+	close(go[0]);
+	close(res[1]);
+	for (i = 0; i < p; i++)
+	    if (write(go[1], "g", 1) != 1)
+		unix_error("write failed in eval_mm_shared");
+	close(go[1]);
+
+	maxsecs = 0;
+	for (i = 0; i < p; i++) {
+	    if (read(res[0], &secs, sizeof(secs)) != sizeof(secs))
+		break;
+	    maxsecs = (secs > maxsecs) ? secs : maxsecs;
+	}
+	close(res[0]);
+	failed = nomem = 0;
+	while (wait(&status) > 0) {
+	    if (WIFEXITED(status) && WEXITSTATUS(status) == SHARED_NOMEM)
+		nomem++;
+	    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failed++;
+	}
+	size = mem_maxheapsize();
+	mem_deinit();
+
+	if (nomem)
+	    printf("%6d%10s%10s%10s  (%d workers ran out of the %lu MB heap, "
+		   "try a larger -m)\n", p, "-", "-", "-", nomem,
+		   (unsigned long)(size >> 20));
+	else if (failed)
+	    printf("%6d%10s%10s%10s  (%d workers failed)\n", 
+		   p, "-", "-", "-", failed);
+	else
+	    printf("%6d%10.6f%10.0f%10.0f\n", p, maxsecs,
+		   (p * trace->num_ops / 1e3) / maxsecs,
+		   (trace->num_ops / 1e3) / maxsecs);
+	if (p == nprocs)
+	    break;
+    }
+    free(speed_params.live);
+}
+
+/*
+ * shared_round - One timed run of an eval_mm_shared worker: replay the
+ *    trace, then free what it left allocated, so that the next run
+ *    starts from the same heap
+ */
+static void shared_round(void *ptr)
+{
+    speed_t *speed_params = (speed_t *)ptr;
+    trace_t *trace = speed_params->trace;
+    traceop_t *op;
+    char *p;
+    int i;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	case REALLOC:
+	    p = (op->type == ALLOC) ? mm_malloc(op->size) :
+		mm_realloc(trace->blocks[op->index], op->size);
+	    if (p == NULL)
+		exit(SHARED_NOMEM);
+	    trace->blocks[op->index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[op->index]);
+	    break;
+	}
+    }
+    for (i = 0; i < speed_params->nlive; i++)
+	mm_free(trace->blocks[speed_params->live[i]]);
+}
+
+/*
+ * pipeline_producer - Allocate a block for every alloc request in the
+ *    trace and pass it on to the consumer
+ */
+static void *pipeline_producer(void *arg)
+{
+    pipeline_t *pl = (pipeline_t *)arg;
+    trace_t *trace = pl->trace;
+    char *p;
+    int i;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+	    app_error("mm_malloc failed in pipeline_producer");
+	while (pl->head - __atomic_load_n(&pl->tail, __ATOMIC_ACQUIRE) 
+	       == PIPE_SLOTS)
+	    sched_yield();
+	pl->ring[pl->head % PIPE_SLOTS] = p;
+	__atomic_store_n(&pl->head, pl->head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * pipeline_consumer - Free every block the producer hands over
+ */
+static void *pipeline_consumer(void *arg)
+{
+    pipeline_t *pl = (pipeline_t *)arg;
+    trace_t *trace = pl->trace;
+    int i;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	while (__atomic_load_n(&pl->head, __ATOMIC_ACQUIRE) == pl->tail)
+	    sched_yield();
+	mm_free(pl->ring[pl->tail % PIPE_SLOTS]);
+	__atomic_store_n(&pl->tail, pl->tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * run_pipelines - Start every producer/consumer pair and wait for them
+ */
+static void run_pipelines(void *ptr)
+{
+    pipeline_t *pl = ((speed_t *)ptr)->pipes;
+    int i, npairs = ((speed_t *)ptr)->npairs;
+
+    for (i = 0; i < npairs; i++) {
+	pl[i].head = pl[i].tail = 0;
+	if (pthread_create(&pl[i].producer, NULL, pipeline_producer, &pl[i]) ||
+	    pthread_create(&pl[i].consumer, NULL, pipeline_consumer, &pl[i]))
+	    app_error("pthread_create failed in run_pipelines");
+    }
+    for (i = 0; i < npairs; i++) {
+	pthread_join(pl[i].producer, NULL);
+	pthread_join(pl[i].consumer, NULL);
+    }
+}
+
+/*
+ * eval_mm_pipeline - Benchmark cross-thread frees: npairs producer
+ *    threads allocate the blocks of the trace and npairs consumer 
+ *    threads free them. Every free comes from a thread that did not
+ *    set up the heap, so this compares frees that take the heap lock
+ *    (MM_THREADSAFE) with frees pushed on the remote free queue
+ *    (MM_REMOTE_FREE) and with per-CPU caches (MM_PERCPU).
+ */
+static void eval_mm_pipeline(trace_t *trace, int tracenum, int npairs)
+{
+    static int modes[] = {MM_THREADSAFE, MM_REMOTE_FREE, MM_PERCPU};
+    static char *names[] = {"locked", "remote", "percpu"};
+    speed_t speed_params;
+    pipeline_t *pl;
+    double secs, ops;
+    int i, m;
+
+    if ((pl = calloc(npairs, sizeof(pipeline_t))) == NULL)
+	unix_error("calloc failed in eval_mm_pipeline");
+    for (i = 0; i < npairs; i++)
+	pl[i].trace = trace;
+    for (i = 0, ops = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].type == ALLOC)
+	    ops += 2 * npairs;
+
+    printf("\nProducer/consumer benchmark, trace %d, %d pairs:\n%8s%10s%10s\n",
+	   tracenum, npairs, "frees", "secs", "Kops");
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+	mem_reset_brk();
+	if (mm_init_flags(modes[m]) < 0)
+	    app_error("mm_init_flags failed in eval_mm_pipeline");
+	speed_params.pipes = pl;
+	speed_params.npairs = npairs;
+	secs = fsecs(run_pipelines, &speed_params);
+	printf("%8s%10.6f%10.0f\n", names[m], secs, (ops / 1e3) / secs);
+    }
+    free(pl);
+}
+
+/*
+ * writer_thread - Allocate blocks of the trace's sizes in lockstep with
+ *    the other writers, then hammer a counter in each of them
+ */
+static void *writer_thread(void *arg)
+{
+    writer_t *w = (writer_t *)arg;
+    trace_t *trace = w->trace;
+    int i, k, r, size;
+
+    for (i = 0, k = 0; i < trace->num_ops && k < WRITE_BLOCKS; i++) {
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	size = trace->ops[i].size;
+	pthread_barrier_wait(w->barrier);
+	if ((w->blocks[k++] = mm_malloc(size < sizeof(long) ? sizeof(long) : size)) == NULL)
+	    app_error("mm_malloc failed in writer_thread");
+    }
+    pthread_barrier_wait(w->barrier);  /* all blocks are in place */
+    pthread_barrier_wait(w->barrier);  /* main has started the clock */
+
+    for (r = 0; r < WRITE_ROUNDS; r++)
+	for (k = 0; k < w->nblocks; k++)
+	    (*(volatile long *)w->blocks[k])++;
+    pthread_barrier_wait(w->barrier);  /* all writes are done */
+
+    for (k = 0; k < w->nblocks; k++)
+	mm_free(w->blocks[k]);
+    return NULL;
+}
+
+/*
+ * cmp_line - qsort comparison for (line, writer) pairs
+ */
+static int cmp_line(const void *a, const void *b)
+{
+    const size_t *x = a, *y = b;
+
+    if (x[0] != y[0])
+	return (x[0] < y[0]) ? -1 : 1;
+    return (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+/*
+ * shared_lines - Count the cache lines that hold a counter of more 
+ *    than one writer
+ */
+static int shared_lines(writer_t *w, int nwriters)
+{
+    size_t (*lines)[2];
+    int i, j, k, multi, n = 0, shared = 0;
+
+    if ((lines = malloc(nwriters * WRITE_BLOCKS * sizeof(*lines))) == NULL)
+	unix_error("malloc failed in shared_lines");
+    for (i = 0; i < nwriters; i++)
+	for (k = 0; k < w[i].nblocks; k++) {
+	    lines[n][0] = (size_t)w[i].blocks[k] / 64;
+	    lines[n++][1] = i;
+	}
+    qsort(lines, n, sizeof(*lines), cmp_line);
+    for (i = 0; i < n; i = j) {
+	for (j = i + 1, multi = 0; j < n && lines[j][0] == lines[i][0]; j++)
+	    if (lines[j][1] != lines[i][1])
+		multi = 1;
+	shared += multi;
+    }
+    free(lines);
+    return shared;
+}
+
+/*
+ * eval_mm_writers - Benchmark false sharing: nwriters threads allocate
+ *    the first blocks of the trace interleaved with each other and
+ *    then write to them as fast as they can. Compares plain
+ *    MM_THREADSAFE, where the blocks of different threads share cache
+ *    lines, with MM_LINEALIGN, where they should not. Only the write
+ *    phase is timed.
+ */
+static void eval_mm_writers(trace_t *trace, int tracenum, int nwriters)
+{
+    static int modes[] = {MM_THREADSAFE, MM_LINEALIGN};
+    static char *names[] = {"locked", "linealign"};
+    pthread_barrier_t barrier;
+    struct timespec t0, t1;
+    writer_t *w;
+    double secs, writes;
+    int i, k, m, shared;
+
+    if ((w = calloc(nwriters, sizeof(writer_t))) == NULL)
+	unix_error("calloc failed in eval_mm_writers");
+    for (i = 0, k = 0; i < trace->num_ops && k < WRITE_BLOCKS; i++)
+	if (trace->ops[i].type == ALLOC)
+	    k++;
+    writes = (double)nwriters * k * WRITE_ROUNDS;
+
+    printf("\nWriter benchmark, trace %d, %d threads, %d blocks each:\n"
+	   "%10s%8s%10s%10s\n", tracenum, nwriters, k, 
+	   "mode", "shared", "secs", "Mwrites");
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+	mem_reset_brk();
+	if (mm_init_flags(modes[m]) < 0)
+	    app_error("mm_init_flags failed in eval_mm_writers");
+	pthread_barrier_init(&barrier, NULL, nwriters + 1);
+	for (i = 0; i < nwriters; i++) {
+	    w[i].trace = trace;
+	    w[i].barrier = &barrier;
+	    w[i].nblocks = k;
+	    if (pthread_create(&w[i].tid, NULL, writer_thread, &w[i]))
+		app_error("pthread_create failed in eval_mm_writers");
+	}
+	for (i = 0; i < k; i++)      /* one round per block */
+	    pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+	shared = shared_lines(w, nwriters);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < nwriters; i++)
+	    pthread_join(w[i].tid, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	secs = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+	printf("%10s%8d%10.6f%10.0f\n", names[m], shared, secs, 
+	       (writes / 1e6) / secs);
+    }
+    free(w);
+}
+
+/*
+ * replay_thread - Run this thread's requests of the trace in order.
+ *    Each request first waits until the ones before it on the same
+ *    block, which may be another thread's, are done.
+ */
+static void *replay_thread(void *arg)
+{
+    replay_t *r = (replay_t *)arg;
+    trace_t *trace = r->trace;
+    traceop_t *op;
+    struct timespec t0, t1;
+    char *p;
+    int i, k, b = 0;
+
+    pthread_barrier_wait(r->barrier);  /* everybody is ready */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (k = 0; k < r->nops; k++) {
+	i = r->ops[k];
+	for (; b < trace->num_barriers && trace->barriers[b] <= i; b++)
+	    pthread_barrier_wait(r->barrier);
+	op = &trace->ops[i];
+	while (__atomic_load_n(&r->done[op->index], __ATOMIC_ACQUIRE) != r->seq[i])
+	    sched_yield();
+
+	switch (op->type) {
+	case ALLOC:
+	    if ((p = mm_malloc(op->size)) == NULL)
+		app_error("mm_malloc failed in replay_thread");
+	    trace->blocks[op->index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[op->index], op->size)) == NULL)
+		app_error("mm_realloc failed in replay_thread");
+	    trace->blocks[op->index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[op->index]);
+	    break;
+	}
+	__atomic_store_n(&r->done[op->index], r->seq[i] + 1, __ATOMIC_RELEASE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (; b < trace->num_barriers; b++)
+	pthread_barrier_wait(r->barrier);
+    r->secs = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay a threaded trace on 1, 2, 4, ... nthreads
+ *    threads against an MM_THREADSAFE | MM_PERCPU heap. With n threads,
+ *    thread t of the trace runs on replay thread t % n, so the blocks
+ *    a trace thread frees may come from any of them. Prints the time
+ *    of all of them, their throughput and its speedup over one thread,
+ *    and the throughput of each thread in the last run (every run with
+ *    -v). Each thread count gets an untimed warm-up run and then the
+ *    best of THREAD_RUNS, so that one thread is not the only cold one.
+ */
+static void eval_mm_threads(trace_t *trace, int tracenum, int nthreads)
+{
+    replay_t *r;
+    int *seq, *done, *ops;
+    int i, k, n, t, run;
+    double secs, best, secs1 = 0;
+
+    if (nthreads > trace->num_threads)
+	nthreads = trace->num_threads;
+    if ((r = calloc(nthreads, sizeof(replay_t))) == NULL ||
+	(seq = malloc(trace->num_ops * sizeof(int))) == NULL ||
+	(done = malloc(trace->num_ids * sizeof(int))) == NULL ||
+	(ops = malloc(trace->num_ops * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+
+    /* Number the requests on each block in trace order */
+    memset(done, 0, trace->num_ids * sizeof(int));
+    for (i = 0; i < trace->num_ops; i++)
+	seq[i] = done[trace->ops[i].index]++;
+
+    printf("\nThreaded replay, trace %d, %d threads, %d barriers:\n"
+	   "%8s%10s%10s%9s\n", tracenum, trace->num_threads, trace->num_barriers,
+	   "threads", "secs", "Kops", "speedup");
+    for (n = 1; ; n = (2*n < nthreads) ? 2*n : nthreads) {
+	/* Hand out the requests, each thread's in one run of ops */
+	for (t = 0; t < n; t++)
+	    r[t].nops = 0;
+	for (i = 0; i < trace->num_ops; i++)
+	    r[TRACE_TID(trace, i) % n].nops++;
+	for (t = 0, k = 0; t < n; t++) {
+	    r[t].ops = ops + k;
+	    k += r[t].nops;
+	    r[t].nops = 0;
+	}
+	for (i = 0; i < trace->num_ops; i++) {
+	    t = TRACE_TID(trace, i) % n;
+	    r[t].ops[r[t].nops++] = i;
+	}
+
+	for (t = 0; t < n; t++) {
+	    r[t].trace = trace;
+	    r[t].seq = seq;
+	    r[t].done = done;
+	}
+	threads_run(trace, r, n);
+	for (run = 0, best = 0; run < THREAD_RUNS; run++) {
+	    secs = threads_run(trace, r, n);
+	    if (run == 0 || secs < best) {
+		best = secs;
+		for (t = 0; t < n; t++)
+		    r[t].best = r[t].secs;
+	    }
+	}
+
+	if (n == 1)
+	    secs1 = best;
+	printf("%8d%10.6f%10.0f%9.2f\n", n, best, (trace->num_ops / 1e3) / best,
+	       secs1 / best);
+	if (verbose || n == nthreads)
+	    for (t = 0; t < n; t++)
+		printf("%16s %d: %d requests, %.0f Kops\n", "thread", t, r[t].nops,
+		       r[t].best > 0 ? (r[t].nops / 1e3) / r[t].best : 0);
+	if (n == nthreads)
+	    break;
+    }
+    free(r);
+    free(seq);
+    free(done);
+    free(ops);
+}
+
+/*
+ * threads_run - Replay the trace once on a new heap with the n replay
+ *    threads in r, which have their requests already, and return the
+ *    time from their start to the last one's end
+ */
+static double threads_run(trace_t *trace, replay_t *r, int n)
+{
+    pthread_barrier_t barrier;
+    struct timespec t0, t1;
+    int i, t;
+
+    mem_reset_brk();
+    if (mm_init_flags(MM_THREADSAFE | MM_PERCPU) < 0)
+	app_error("mm_init_flags failed in threads_run");
+    memset(r[0].done, 0, trace->num_ids * sizeof(int));
+    pthread_barrier_init(&barrier, NULL, n + 1);
+    for (t = 0; t < n; t++) {
+	r[t].barrier = &barrier;
+	if (pthread_create(&r[t].tid, NULL, replay_thread, &r[t]))
+	    app_error("pthread_create failed in threads_run");
+    }
+    pthread_barrier_wait(&barrier);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < trace->num_barriers; i++)
+	pthread_barrier_wait(&barrier);
+    for (t = 0; t < n; t++)
+	pthread_join(r[t].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&barrier);
+
+    return (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+}
+
+/*
+ * class_speed - Look up the size class of every size in CLASS_SIZES
+ *     request sizes (the fsecs function of eval_size_class)
+ */
+static volatile unsigned int class_sink;
+
+static void class_speed(void *ptr)
+{
+    size_t *sizes = (size_t *)ptr;
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i < CLASS_SIZES; i++)
+	sum += mm_size_class(sizes[i]);
+    class_sink = sum;
+}
+
+/*
+ * eval_size_class - Time mm_size_class on its own, for random request
+ *     sizes served by the lookup table and for larger ones that take
+ *     the formula, and print the cost of one lookup
+ */
+static void eval_size_class(void)
+{
+    static const struct {
+	char *name;
+	size_t lo, hi;
+    } ranges[] = {{"table", 1, 4000}, {"formula", 4096, 1 << 24}};
+    size_t *sizes;
+    double secs;
+    unsigned int seed = 1;
+    int r, i;
+
+    if ((sizes = malloc(CLASS_SIZES * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in eval_size_class");
+
+    printf("\nSize-class lookup, %d random sizes:\n%10s%18s%10s\n", 
+	   CLASS_SIZES, "path", "sizes", "ns/op");
+    for (r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+	for (i = 0; i < CLASS_SIZES; i++)
+	    sizes[i] = ranges[r].lo + rand_r(&seed) % (ranges[r].hi - ranges[r].lo);
+	secs = fsecs(class_speed, sizes);
+	printf("%10s%8lu-%-9lu%10.2f\n", ranges[r].name, (unsigned long)ranges[r].lo,
+	       (unsigned long)ranges[r].hi, secs * 1e9 / CLASS_SIZES);
+    }
+    free(sizes);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -923,6 +3292,59 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * dtlb_misses - Count the dTLB load misses of one call of f(argp) with
+ *    a perf counter. Returns -1 if the counter is not available.
+ */
+static double dtlb_misses(ftimer_test_funct f, void *argp)
+{
+    struct perf_event_attr attr;
+    long long count;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+	(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if ((fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) < 0)
+	return -1;
+
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    f(argp);
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+	count = -1;
+    close(fd);
+    return count;
+}
+
+/*
+ * printdtlb - prints the dTLB misses counted for each trace (-D)
+ */
+static void printdtlb(int n, stats_t *stats)
+{
+    int i;
+
+    printf("dTLB load misses for mm malloc:\n%5s%12s%10s\n", 
+	   "trace", "misses", "per Kop");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	if (stats[i].dtlb < 0)
+	    printf("%2d%15s%10s\n", i, "n/a", "-");
+	else
+	    printf("%2d%15.0f%10.1f\n", i, stats[i].dtlb, 
+		   stats[i].dtlb / (stats[i].ops / 1e3));
+    }
+    printf("\n");
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -937,7 +3359,20 @@ static void printresults(int n, stats_t *stats)
     printf("%5s%7s %5s%8s%10s%6s\n", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
     for (i=0; i < n; i++) {
-	if (stats[i].valid) {
+	if (stats[i].valid && stats[i].secs <= 0) {
+	    /* too quick for the timer, e.g. a short tail after -R */
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6s\n", 
+		   i,
+		   "yes",
+		   stats[i].util*100.0,
+		   stats[i].ops,
+		   stats[i].secs,
+		   "n/a");
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	}
+	else if (stats[i].valid) {
 	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
 		   i,
 		   "yes",
@@ -961,7 +3396,15 @@ static void printresults(int n, stats_t *stats)
     }
 
     /* Print the aggregate results for the set of traces */
-    if (errors == 0) {
+    if (errors == 0 && secs <= 0) {
+	printf("%12s%5.0f%%%8.0f%10.6f%6s\n", 
+	       "Total       ",
+	       (util/n)*100.0,
+	       ops, 
+	       secs,
+	       "n/a");
+    }
+    else if (errors == 0) {
 	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
@@ -1012,14 +3455,31 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcCHDpsX] [-f <file>] [-t <dir>] [-j <n>] [-A <file>] [-m <size>] [-F <size>] [-S <op>] [-R <ckpt>] [-M <n>] [-P <n>] [-T <n>] [-W <n>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-A <file>  Time reopening a heap kept in <file> against replaying it.\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c         Time the size-class lookup of mm malloc.\n");
+    fprintf(stderr, "\t-C         Write each trace as a binary .rpb file and exit.\n");
+    fprintf(stderr, "\t-D         Count dTLB misses of each trace with perf counters.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <size>  Pre-fault <size> bytes past the brk from a helper thread.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Back the heap with transparent huge pages.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate the traces in <n> worker processes.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-m <size>  Cap the heap at <size> bytes (K, M, G suffixes).\n");
+    fprintf(stderr, "\t-M <n>     Stress a heap shared by up to <n> processes.\n");
+    fprintf(stderr, "\t-p         Pre-fault heap memory as it is handed out.\n");
+    fprintf(stderr, "\t-P <n>     Benchmark cross-thread frees with <n> thread pairs.\n");
+    fprintf(stderr, "\t-T <n>     Replay threaded traces on 1, 2, 4, ... <n> threads.\n");
+    fprintf(stderr, "\t-W <n>     Benchmark false sharing with <n> writer threads.\n");
+    fprintf(stderr, "\t-R <ckpt>  Resume from checkpoint <ckpt>, time only the rest.\n");
+    fprintf(stderr, "\t-s         Replay each trace as it is read, for traces larger than memory.\n");
+    fprintf(stderr, "\t-S <op>    Save a checkpoint before request <op> of each trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-X         With -j, let only one worker at a time time its trace.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
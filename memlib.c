@@ -2,6 +2,11 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * All the state of one simulated heap lives in a mem_ctx_t, so that a
+ * process can run many heaps side by side. The mem_ctx_* functions work
+ * on the context they are given; the plain mem_* functions are shims
+ * that work on a default context.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,86 +15,586 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * The heap region is only reserved up front. mem_ctx_sbrk commits it
+ * MEM_COMMIT bytes at a time (MEM_HUGEPAGE for a huge page heap) as the
+ * brk passes commit_brk, so the cap can be many GB without costing
+ * anything until it is used. The cap is
+ * MAX_HEAP unless set by mem_set_max_heap or MEM_MAX_HEAP in the
+ * environment.
+ */
+#define MEM_COMMIT (1<<16)
+
+#define MEM_HUGEPAGE (1<<21)   /* transparent huge page size (2 MB) */
+
+/*
+ * A file-backed heap keeps this record in the page in front of the
+ * heap, so that the brk survives together with the heap contents.
+ */
+#define MEM_MAGIC 0x4d4c4842    /* "MLHB" */
+typedef struct {
+    unsigned int magic;  /* MEM_MAGIC once the file has been initialized */
+    size_t max_heap;     /* heap cap the file was created with */
+    size_t brk;          /* current heap size in bytes */
+} mem_hdr_t;
+
+/*
+ * Pre-faulting (mem_set_prefault) takes the page faults of fresh heap
+ * memory out of the requests that first touch it: MEM_PREFAULT_POPULATE
+ * faults in each stretch as mem_ctx_sbrk reaches it, MEM_PREFAULT_THREAD
+ * has a helper thread keep pf_ahead bytes past the brk faulted in.
+ * Everything below fault_brk has been faulted in already.
+ */
+struct mem_ctx {
+    char *start_brk;      /* points to first byte of heap */
+    char *brk;            /* points to last byte of heap */
+    char *max_addr;       /* largest legal heap address */
+    size_t max_heap;      /* size of the heap region */
+    char *commit_brk;     /* end of the committed part, NULL if all is */
+    size_t commit_step;   /* bytes committed at a time */
+
+    mem_hdr_t *hdr;       /* file header, NULL unless file-backed */
+    int fd;               /* descriptor of the backing file */
+    size_t map_size;      /* bytes mapped from the backing file */
+    char shm_name[256];   /* shared memory object name, if shared */
+    pid_t shm_owner;      /* process that created shm_name */
+    int huge;             /* heap comes from mem_ctx_init_huge */
+
+    int pf_flags;         /* MEM_PREFAULT_* */
+    size_t pf_ahead;      /* distance the helper runs ahead */
+    char *fault_brk;      /* end of the faulted-in part */
+    pthread_t pf_thread;
+    int pf_running, pf_stop;
+    pthread_mutex_t pf_lock;
+    pthread_cond_t pf_cond;
+
+    void *client;         /* state of the allocator built on the heap */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_ctx_t mem_default = {
+    .fd = -1,
+    .pf_lock = PTHREAD_MUTEX_INITIALIZER,
+    .pf_cond = PTHREAD_COND_INITIALIZER,
+};
+static size_t mem_cap;       /* cap from mem_set_max_heap, 0 if unset */
+static int mem_pf_flags;     /* pre-faulting for heaps set up from now on */
+static size_t mem_pf_ahead;
+
+static void mem_populate(char *lo, char *hi);
+static void mem_prefault_start(mem_ctx_t *ctx);
+static void mem_prefault_stop(mem_ctx_t *ctx);
 
-/* 
- * mem_init - initialize the memory system model
+/*
+ * mem_parse_size - convert a byte count with an optional K, M or G
+ *    suffix, e.g. "512M". Returns 0 if s is not one.
  */
-void mem_init(void)
+size_t mem_parse_size(char *s)
+{
+    char *end;
+    size_t size = strtoull(s, &end, 10);
+
+    switch (toupper((unsigned char)*end)) {
+    case 'G': size <<= 10; /* fall through */
+    case 'M': size <<= 10; /* fall through */
+    case 'K': size <<= 10; end++; break;
+    }
+    return (end == s || *end != '\0') ? 0 : size;
+}
+
+/*
+ * mem_set_max_heap - set the heap cap for the next mem_init*
+ */
+void mem_set_max_heap(size_t size)
+{
+    mem_cap = size;
+}
+
+/*
+ * mem_limit - the heap cap to use: mem_set_max_heap, else MEM_MAX_HEAP
+ *    from the environment, else MAX_HEAP
+ */
+static size_t mem_limit(void)
+{
+    char *env = getenv("MEM_MAX_HEAP");
+    size_t size;
+
+    if (mem_cap != 0)
+        return mem_cap;
+    if (env != NULL) {
+        if ((size = mem_parse_size(env)) != 0)
+            return size;
+        fprintf(stderr, "mem_init: ignoring bad MEM_MAX_HEAP %s\n", env);
+    }
+    return MAX_HEAP;
+}
+
+/*
+ * mem_default_ctx - the context the plain mem_* functions work on
+ */
+mem_ctx_t *mem_default_ctx(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-        fprintf(stderr, "mem_init_vm: malloc error\n");
+    return &mem_default;
+}
+
+/*
+ * mem_ctx_new - create a context for one more heap. It holds no heap
+ *    until one of the mem_ctx_init* functions sets one up.
+ */
+mem_ctx_t *mem_ctx_new(void)
+{
+    mem_ctx_t *ctx;
+
+    if ((ctx = calloc(1, sizeof(mem_ctx_t))) == NULL) {
+        fprintf(stderr, "mem_ctx_new: calloc error\n");
         exit(1);
     }
+    ctx->fd = -1;
+    pthread_mutex_init(&ctx->pf_lock, NULL);
+    pthread_cond_init(&ctx->pf_cond, NULL);
+    return ctx;
+}
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+/*
+ * mem_ctx_free - release a context made by mem_ctx_new, once
+ *    mem_ctx_deinit has been called on it
+ */
+void mem_ctx_free(mem_ctx_t *ctx)
+{
+    pthread_mutex_destroy(&ctx->pf_lock);
+    pthread_cond_destroy(&ctx->pf_cond);
+    free(ctx);
 }
 
-/* 
- * mem_deinit - free the storage used by the memory system model
+/*
+ * mem_ctx_client - a pointer the allocator built on the heap may use
+ *    for its own per-process state of the context
  */
-void mem_deinit(void)
+void **mem_ctx_client(mem_ctx_t *ctx)
 {
-    free(mem_start_brk);
+    return &ctx->client;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_ctx_init - initialize the memory system model
  */
-void mem_reset_brk()
+void mem_ctx_init(mem_ctx_t *ctx)
+{
+    /* reserve the address space we will use to model the available VM */
+    ctx->max_heap = mem_limit();
+    ctx->start_brk = mmap(NULL, ctx->max_heap, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ctx->start_brk == MAP_FAILED) {
+        fprintf(stderr, "mem_init: cannot reserve %zu bytes: %s\n",
+                ctx->max_heap, strerror(errno));
+        exit(1);
+    }
+
+    ctx->commit_brk = ctx->start_brk;               /* nothing committed yet */
+    ctx->commit_step = MEM_COMMIT;
+    ctx->max_addr = ctx->start_brk + ctx->max_heap; /* max legal heap address */
+    ctx->brk = ctx->start_brk;                      /* heap is empty initially */
+    mem_prefault_start(ctx);
+}
+
+/*
+ * mem_ctx_init_huge - initialize the memory system model on anonymous
+ *    memory that starts on a huge page boundary and is marked
+ *    MADV_HUGEPAGE, so the kernel can back it with transparent huge
+ *    pages instead of 4 KB ones. It is reserved like mem_ctx_init's,
+ *    but committed a whole huge page at a time.
+ */
+void mem_ctx_init_huge(mem_ctx_t *ctx)
+{
+    size_t len;
+    char *map;
+
+    ctx->max_heap = mem_limit();
+    len = ctx->max_heap + MEM_HUGEPAGE;
+    map = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mem_init_huge: cannot reserve %zu bytes: %s\n",
+                len, strerror(errno));
+        exit(1);
+    }
+
+    /* keep the aligned max_heap bytes and unmap the slack around them */
+    ctx->start_brk = (char *)(((size_t)map + MEM_HUGEPAGE-1) & ~(size_t)(MEM_HUGEPAGE-1));
+    if (ctx->start_brk > map)
+        munmap(map, ctx->start_brk - map);
+    if (map + len > ctx->start_brk + ctx->max_heap)
+        munmap(ctx->start_brk + ctx->max_heap, map + len - (ctx->start_brk + ctx->max_heap));
+#ifdef MADV_HUGEPAGE
+    if (madvise(ctx->start_brk, ctx->max_heap, MADV_HUGEPAGE) < 0)
+        fprintf(stderr, "mem_init_huge: no transparent huge pages: %s\n",
+                strerror(errno));
+#endif
+
+    ctx->huge = 1;
+    ctx->commit_brk = ctx->start_brk;
+    ctx->commit_step = MEM_HUGEPAGE;
+    ctx->max_addr = ctx->start_brk + ctx->max_heap;
+    ctx->brk = ctx->start_brk;
+    mem_prefault_start(ctx);
+}
+
+/*
+ * mem_map_fd - map the heap file open on ctx->fd, creating the header
+ *    if the file is still empty. A file that already holds a heap keeps
+ *    the cap it was created with. Returns 1 if it already held a heap.
+ */
+static int mem_map_fd(mem_ctx_t *ctx, char *name, void *base)
+{
+    struct stat st;
+    size_t hdrsize = mem_pagesize();
+    char *map = MAP_FAILED;
+    int existed;
+
+    if (fstat(ctx->fd, &st) < 0) {
+        fprintf(stderr, "mem_map_fd: cannot stat %s: %s\n",
+                name, strerror(errno));
+        exit(1);
+    }
+    existed = (st.st_size != 0);
+    if (existed && (size_t)st.st_size <= hdrsize) {
+        fprintf(stderr, "mem_map_fd: %s is not a heap file\n", name);
+        exit(1);
+    }
+    ctx->max_heap = existed ? st.st_size - hdrsize : mem_limit();
+    ctx->map_size = hdrsize + ctx->max_heap;
+    if (!existed && ftruncate(ctx->fd, ctx->map_size) < 0) {
+        fprintf(stderr, "mem_map_fd: ftruncate error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    /* the header page sits in front of the heap, so map it one page lower */
+#ifdef MAP_FIXED_NOREPLACE
+    if (base != NULL)
+        map = mmap((char *)base - hdrsize, ctx->map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED_NOREPLACE, ctx->fd, 0);
+#endif
+    if (map == MAP_FAILED)
+        map = mmap(base ? (char *)base - hdrsize : NULL, ctx->map_size,
+                   PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mem_map_fd: mmap error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    ctx->hdr = (mem_hdr_t *)map;
+    if (!existed) {
+        ctx->hdr->max_heap = ctx->max_heap;
+        ctx->hdr->brk = 0;
+        ctx->hdr->magic = MEM_MAGIC;
+    }
+    else if (ctx->hdr->magic != MEM_MAGIC || ctx->hdr->brk > ctx->max_heap) {
+        fprintf(stderr, "mem_map_fd: %s is not a heap file\n", name);
+        exit(1);
+    }
+
+    ctx->start_brk = map + hdrsize;
+    ctx->commit_brk = NULL;
+    ctx->max_addr = ctx->start_brk + ctx->max_heap;
+    ctx->brk = ctx->start_brk + ctx->hdr->brk;
+    mem_prefault_start(ctx);
+    return existed;
+}
+
+/*
+ * mem_ctx_init_file - initialize the memory system model on top of a
+ *    file mapping, so the heap outlives the process. If base is not
+ *    NULL the heap is placed there when that range is free, otherwise
+ *    wherever the kernel puts it. Returns 1 if path already held a heap
+ *    (which the caller should adopt with mm_attach) and 0 if it was
+ *    created.
+ */
+int mem_ctx_init_file(mem_ctx_t *ctx, char *path, void *base)
+{
+    if ((ctx->fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+        fprintf(stderr, "mem_init_file: cannot open %s: %s\n",
+                path, strerror(errno));
+        exit(1);
+    }
+    return mem_map_fd(ctx, path, base);
+}
+
+/*
+ * mem_ctx_init_shared - initialize the memory system model on a POSIX
+ *    shared memory object, so that several processes can use one heap.
+ *    Each process may get the heap at a different address. Returns 1
+ *    if name already held a heap (adopt it with mm_attach) and 0 if
+ *    this process created it; the creator removes the name again in
+ *    mem_ctx_deinit.
+ */
+int mem_ctx_init_shared(mem_ctx_t *ctx, char *name)
+{
+    ctx->shm_owner = 0;
+    if ((ctx->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0)
+        ctx->shm_owner = getpid();
+    else if (errno != EEXIST || (ctx->fd = shm_open(name, O_RDWR, 0600)) < 0) {
+        fprintf(stderr, "mem_init_shared: cannot open %s: %s\n",
+                name, strerror(errno));
+        exit(1);
+    }
+    strncpy(ctx->shm_name, name, sizeof(ctx->shm_name) - 1);
+    return mem_map_fd(ctx, name, NULL);
+}
+
+/*
+ * mem_ctx_is_shared - returns 1 if other processes may be using the heap
+ */
+int mem_ctx_is_shared(mem_ctx_t *ctx)
+{
+    return ctx->shm_name[0] != '\0';
+}
+
+/*
+ * mem_ctx_deinit - free the storage used by the memory system model
+ */
+void mem_ctx_deinit(mem_ctx_t *ctx)
+{
+    mem_prefault_stop(ctx);
+    if (ctx->hdr != NULL) {
+        munmap(ctx->hdr, ctx->map_size);
+        close(ctx->fd);
+        if (mem_ctx_is_shared(ctx) && ctx->shm_owner == getpid())
+            shm_unlink(ctx->shm_name);
+        ctx->shm_name[0] = '\0';
+        ctx->hdr = NULL;
+        ctx->fd = -1;
+        return;
+    }
+    munmap(ctx->start_brk, ctx->max_heap);
+    ctx->huge = 0;
+}
+
+/*
+ * mem_ctx_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void mem_ctx_reset_brk(mem_ctx_t *ctx)
 {
-    mem_brk = mem_start_brk;
+    ctx->brk = ctx->start_brk;
+    if (ctx->hdr != NULL)
+        ctx->hdr->brk = 0;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+/*
+ * mem_ctx_sbrk - simple model of the sbrk function. Extends the heap
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) 
+void *mem_ctx_sbrk(mem_ctx_t *ctx, int incr)
 {
-    char *old_brk = mem_brk;
+    char *old_brk, *end;
+    size_t ahead;
+
+    if (ctx->hdr != NULL)   /* another process may have moved the brk */
+        ctx->brk = ctx->start_brk + ctx->hdr->brk;
+    old_brk = ctx->brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr < 0) || ((ctx->brk + incr) > ctx->max_addr)) {
         errno = ENOMEM;
         fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
         return (void *)-1;
     }
-    mem_brk += incr;
+    /*
+     * Commit whole commit_step steps of the reservation as the brk
+     * passes, and far enough ahead for the pre-fault helper
+     */
+    ahead = (ctx->pf_flags & MEM_PREFAULT_THREAD) ? ctx->pf_ahead : 0;
+    if (ctx->commit_brk != NULL && ctx->brk + incr + ahead > ctx->commit_brk) {
+        size_t grow = (ctx->brk + incr + ahead - ctx->commit_brk + ctx->commit_step-1) &
+            ~(size_t)(ctx->commit_step-1);
+
+        if (grow > (size_t)(ctx->max_addr - ctx->commit_brk))
+            grow = ctx->max_addr - ctx->commit_brk;
+        if (mprotect(ctx->commit_brk, grow, PROT_READ | PROT_WRITE) < 0) {
+            errno = ENOMEM;
+            fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit memory...\n");
+            return (void *)-1;
+        }
+        __atomic_store_n(&ctx->commit_brk, ctx->commit_brk + grow, __ATOMIC_RELEASE);
+    }
+    ctx->brk += incr;
+    if (ctx->hdr != NULL)
+        ctx->hdr->brk = ctx->brk - ctx->start_brk;
+
+    /* fault in what the caller is about to touch, a MEM_COMMIT step at a time */
+    if ((ctx->pf_flags & MEM_PREFAULT_POPULATE) && ctx->brk > ctx->fault_brk) {
+        end = ctx->start_brk + ((ctx->brk - ctx->start_brk + MEM_COMMIT-1) &
+                                ~(size_t)(MEM_COMMIT-1));
+        if (end > (ctx->commit_brk != NULL ? ctx->commit_brk : ctx->max_addr))
+            end = (ctx->commit_brk != NULL ? ctx->commit_brk : ctx->max_addr);
+        mem_populate(ctx->fault_brk, end);
+        __atomic_store_n(&ctx->fault_brk, end, __ATOMIC_RELAXED);
+    }
+    if (ctx->pf_running && ctx->brk + ctx->pf_ahead / 2 > ctx->fault_brk) {
+        pthread_mutex_lock(&ctx->pf_lock);
+        pthread_cond_signal(&ctx->pf_cond);
+        pthread_mutex_unlock(&ctx->pf_lock);
+    }
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_set_prefault - choose how fresh heap memory is faulted in ahead
+ *    of its first use (MEM_PREFAULT_* flags, 0 for on demand) and how
+ *    far ahead of the brk the MEM_PREFAULT_THREAD helper stays. Takes
+ *    effect at the next mem_init*.
  */
-void *mem_heap_lo()
+void mem_set_prefault(int flags, size_t ahead)
 {
-    return (void *)mem_start_brk;
+    mem_pf_flags = flags;
+    mem_pf_ahead = ahead;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * mem_populate - fault in the pages of [lo, hi) for writing
  */
-void *mem_heap_hi()
+static void mem_populate(char *lo, char *hi)
+{
+    size_t pagesize = mem_pagesize();
+    char *p;
+
+    if (hi <= lo)
+        return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(lo, hi - lo, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    /* an atomic add of 0 writes each page without changing it */
+    for (p = (char *)((size_t)lo & ~(pagesize-1)); p < hi; p += pagesize)
+        __atomic_fetch_add((int *)p, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_prefaulter - the MEM_PREFAULT_THREAD helper: whenever the brk
+ *    gets within pf_ahead of fault_brk, fault in the committed memory
+ *    up to pf_ahead past it
+ */
+static void *mem_prefaulter(void *arg)
+{
+    mem_ctx_t *ctx = (mem_ctx_t *)arg;
+    char *lo, *hi, *limit;
+
+    pthread_mutex_lock(&ctx->pf_lock);
+    while (!ctx->pf_stop) {
+        lo = __atomic_load_n(&ctx->fault_brk, __ATOMIC_RELAXED);
+        hi = __atomic_load_n(&ctx->brk, __ATOMIC_RELAXED) + ctx->pf_ahead;
+        limit = __atomic_load_n(&ctx->commit_brk, __ATOMIC_ACQUIRE);
+        if (limit == NULL)
+            limit = ctx->max_addr;
+        if (hi > limit)
+            hi = limit;
+        if (lo >= hi) {
+            pthread_cond_wait(&ctx->pf_cond, &ctx->pf_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ctx->pf_lock);
+        mem_populate(lo, hi);
+        __atomic_store_n(&ctx->fault_brk, hi, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&ctx->pf_lock);
+    }
+    pthread_mutex_unlock(&ctx->pf_lock);
+    return NULL;
+}
+
+/*
+ * mem_prefault_start - set up pre-faulting for a fresh heap region
+ */
+static void mem_prefault_start(mem_ctx_t *ctx)
 {
-    return (void *)(mem_brk - 1);
+    ctx->pf_flags = mem_pf_flags;
+    ctx->pf_ahead = mem_pf_ahead;
+    ctx->fault_brk = ctx->start_brk;
+    if (!(ctx->pf_flags & MEM_PREFAULT_THREAD) || ctx->pf_ahead == 0)
+        return;
+    ctx->pf_stop = 0;
+    if (pthread_create(&ctx->pf_thread, NULL, mem_prefaulter, ctx) != 0) {
+        fprintf(stderr, "mem_prefault_start: cannot start the helper thread\n");
+        return;
+    }
+    ctx->pf_running = 1;
+}
+
+/*
+ * mem_prefault_stop - stop the pre-fault helper before the region goes
+ */
+static void mem_prefault_stop(mem_ctx_t *ctx)
+{
+    if (!ctx->pf_running)
+        return;
+    pthread_mutex_lock(&ctx->pf_lock);
+    ctx->pf_stop = 1;
+    pthread_cond_signal(&ctx->pf_cond);
+    pthread_mutex_unlock(&ctx->pf_lock);
+    pthread_join(ctx->pf_thread, NULL);
+    ctx->pf_running = 0;
+}
+
+/*
+ * mem_ctx_purge - give the pages of [lo, lo+len) back to the system.
+ *    The range stays part of the heap and reads back as zeros. A shared
+ *    or file mapping needs MADV_REMOVE, since MADV_DONTNEED would only
+ *    drop this process's view of pages the file still holds.
+ */
+void mem_ctx_purge(mem_ctx_t *ctx, void *lo, size_t len)
+{
+    if (madvise(lo, len, ctx->hdr != NULL ? MADV_REMOVE : MADV_DONTNEED) < 0)
+        fprintf(stderr, "mem_purge: madvise error: %s\n", strerror(errno));
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_ctx_heap_lo - return address of the first heap byte
  */
-size_t mem_heapsize() 
+void *mem_ctx_heap_lo(mem_ctx_t *ctx)
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (void *)ctx->start_brk;
+}
+
+/*
+ * mem_ctx_heap_hi - return address of last heap byte
+ */
+void *mem_ctx_heap_hi(mem_ctx_t *ctx)
+{
+    if (ctx->hdr != NULL)
+        ctx->brk = ctx->start_brk + ctx->hdr->brk;
+    return (void *)(ctx->brk - 1);
+}
+
+/*
+ * mem_ctx_heapsize() - returns the heap size in bytes
+ */
+size_t mem_ctx_heapsize(mem_ctx_t *ctx)
+{
+    if (ctx->hdr != NULL)
+        ctx->brk = ctx->start_brk + ctx->hdr->brk;
+    return (size_t)(ctx->brk - ctx->start_brk);
+}
+
+/*
+ * mem_ctx_hugepagesize() - returns the huge page size the heap is
+ *    aligned to, or 0 unless it was set up by mem_ctx_init_huge
+ */
+size_t mem_ctx_hugepagesize(mem_ctx_t *ctx)
+{
+    return ctx->huge ? MEM_HUGEPAGE : 0;
+}
+
+/*
+ * mem_ctx_maxheapsize() - returns the heap cap in bytes
+ */
+size_t mem_ctx_maxheapsize(mem_ctx_t *ctx)
+{
+    return ctx->max_heap;
 }
 
 /*
@@ -99,3 +604,76 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * The single-heap interface, on the default context
+ */
+void mem_init(void)
+{
+    mem_ctx_init(&mem_default);
+}
+
+void mem_init_huge(void)
+{
+    mem_ctx_init_huge(&mem_default);
+}
+
+int mem_init_file(char *path, void *base)
+{
+    return mem_ctx_init_file(&mem_default, path, base);
+}
+
+int mem_init_shared(char *name)
+{
+    return mem_ctx_init_shared(&mem_default, name);
+}
+
+int mem_is_shared(void)
+{
+    return mem_ctx_is_shared(&mem_default);
+}
+
+void mem_deinit(void)
+{
+    mem_ctx_deinit(&mem_default);
+}
+
+void mem_reset_brk()
+{
+    mem_ctx_reset_brk(&mem_default);
+}
+
+void *mem_sbrk(int incr)
+{
+    return mem_ctx_sbrk(&mem_default, incr);
+}
+
+void mem_purge(void *lo, size_t len)
+{
+    mem_ctx_purge(&mem_default, lo, len);
+}
+
+void *mem_heap_lo()
+{
+    return mem_ctx_heap_lo(&mem_default);
+}
+
+void *mem_heap_hi()
+{
+    return mem_ctx_heap_hi(&mem_default);
+}
+
+size_t mem_heapsize()
+{
+    return mem_ctx_heapsize(&mem_default);
+}
+
+size_t mem_hugepagesize()
+{
+    return mem_ctx_hugepagesize(&mem_default);
+}
+
+size_t mem_maxheapsize()
+{
+    return mem_ctx_maxheapsize(&mem_default);
+}
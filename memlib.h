@@ -1,11 +1,50 @@
 #include <unistd.h>
 
+/* 
+ * One simulated heap. Each mem_ctx_* function works on the context it
+ * is given, and the plain mem_* functions on mem_default_ctx().
+ */
+typedef struct mem_ctx mem_ctx_t;
+
 void mem_init(void);               
+void mem_set_max_heap(size_t size);
+size_t mem_parse_size(char *s);
+void mem_set_prefault(int flags, size_t ahead);
+int mem_init_file(char *path, void *base);
+int mem_init_shared(char *name);
+void mem_init_huge(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void mem_purge(void *lo, size_t len);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_maxheapsize(void);
 size_t mem_pagesize(void);
+size_t mem_hugepagesize(void);
+int mem_is_shared(void);
+
+mem_ctx_t *mem_default_ctx(void);
+mem_ctx_t *mem_ctx_new(void);
+void mem_ctx_free(mem_ctx_t *ctx);
+void **mem_ctx_client(mem_ctx_t *ctx);
+void mem_ctx_init(mem_ctx_t *ctx);
+int mem_ctx_init_file(mem_ctx_t *ctx, char *path, void *base);
+int mem_ctx_init_shared(mem_ctx_t *ctx, char *name);
+void mem_ctx_init_huge(mem_ctx_t *ctx);
+void mem_ctx_deinit(mem_ctx_t *ctx);
+void *mem_ctx_sbrk(mem_ctx_t *ctx, int incr);
+void mem_ctx_reset_brk(mem_ctx_t *ctx);
+void mem_ctx_purge(mem_ctx_t *ctx, void *lo, size_t len);
+void *mem_ctx_heap_lo(mem_ctx_t *ctx);
+void *mem_ctx_heap_hi(mem_ctx_t *ctx);
+size_t mem_ctx_heapsize(mem_ctx_t *ctx);
+size_t mem_ctx_maxheapsize(mem_ctx_t *ctx);
+size_t mem_ctx_hugepagesize(mem_ctx_t *ctx);
+int mem_ctx_is_shared(mem_ctx_t *ctx);
+
 
+/* Flags for mem_set_prefault */
+#define MEM_PREFAULT_POPULATE 0x1  /* fault in memory as mem_sbrk reaches it */
+#define MEM_PREFAULT_THREAD   0x2  /* keep memory past the brk faulted in */
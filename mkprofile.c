@@ -0,0 +1,268 @@
+/*
+ * mkprofile.c - Size profile generator for mm.c
+ *
+ * Replays the requests of one or more .rep traces and writes a header
+ * for mm.c to stdout: the block sizes that are worth having on the free
+ * lists from the start, how many blocks of each to pre-carve at
+ * mm_init, and a chunk size for growing the heap. Build mm.c against it
+ * with "make MM_PROFILE=<header>".
+ *
+ * Blocks are cut to the exact (aligned) request size rather than to
+ * the size of their class, so the class boundaries of mm.c waste no
+ * space and are not part of the profile.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+
+#define DSIZE      8           /* as in mm.c */
+#define OVERHEAD   8
+#define SMALL_MAX  4096        /* largest block size that is prewarmed */
+#define MAXLINE    1024
+
+#define ASIZE(size) ((size) <= DSIZE ? DSIZE + OVERHEAD : \
+                     DSIZE * (((size) + OVERHEAD + DSIZE-1) / DSIZE))
+
+/* What the traces do with blocks of one size */
+typedef struct {
+    unsigned int asize;        /* block size */
+    unsigned long allocs;      /* requests served by a block of this size */
+    unsigned int live;         /* blocks live in the current trace */
+    unsigned int peak;         /* most live at once within the window */
+    unsigned int count;        /* blocks to prewarm */
+} sizestat_t;
+
+static sizestat_t stats[SMALL_MAX/DSIZE + 1];
+static unsigned int *asizes;   /* every block size requested, for the chunk */
+static size_t nasizes, maxasizes;
+
+static void read_trace(char *path, int window);
+static void add_asize(unsigned int asize);
+static void adjust(unsigned int asize, int delta, int counted);
+static int by_allocs(const void *a, const void *b);
+static int by_asize(const void *a, const void *b);
+static int cmp_uint(const void *a, const void *b);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    int window = 0;            /* ops at the start of each trace (-n) */
+    size_t budget = 256*1024;  /* bytes to prewarm at most (-b) */
+    int maxsizes = 16;         /* sizes to prewarm at most (-k) */
+    sizestat_t chosen[SMALL_MAX/DSIZE + 1];
+    int nchosen = 0;
+    size_t used = 0;
+    unsigned int chunk, median;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "n:b:k:h")) != EOF) {
+	switch (c) {
+	case 'n': /* Only the first <ops> requests count as start-up */
+	    window = atoi(optarg);
+	    break;
+	case 'b': /* Prewarm at most <bytes> */
+	    budget = strtoul(optarg, NULL, 0);
+	    break;
+	case 'k': /* Prewarm at most <n> sizes */
+	    maxsizes = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	    exit(c == 'h' ? 0 : 1);
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+
+    for (i = 0; i <= SMALL_MAX/DSIZE; i++)
+	stats[i].asize = i * DSIZE;
+    for (i = optind; i < argc; i++)
+	read_trace(argv[i], window);
+
+    /*
+     * The most requested sizes get as many blocks as were ever live at
+     * once during start-up, until the budget runs out
+     */
+    qsort(stats, SMALL_MAX/DSIZE + 1, sizeof(sizestat_t), by_allocs);
+    for (i = 0; i <= SMALL_MAX/DSIZE && nchosen < maxsizes; i++) {
+	if (stats[i].allocs == 0 || stats[i].peak == 0)
+	    break;
+	stats[i].count = stats[i].peak;
+	if (used + (size_t)stats[i].count * stats[i].asize > budget)
+	    stats[i].count = (budget - used) / stats[i].asize;
+	if (stats[i].count == 0)
+	    continue;
+	used += (size_t)stats[i].count * stats[i].asize;
+	chosen[nchosen++] = stats[i];
+    }
+    qsort(chosen, nchosen, sizeof(sizestat_t), by_asize);
+
+    /*
+     * A larger chunk saves sbrk calls, but whatever it adds beyond the
+     * request stays free at the end of the heap, and requests above the
+     * chunk grow the heap by just their size anyway, so the chunk is the
+     * largest power of two that half the requests reach
+     */
+    median = 0;
+    if (nasizes > 0) {
+	qsort(asizes, nasizes, sizeof(unsigned int), cmp_uint);
+	median = asizes[nasizes / 2];
+    }
+    for (chunk = 1<<12; 2*chunk <= median && chunk < (1<<20); chunk <<= 1)
+	;
+
+    printf("/* \n * Size profile generated by mkprofile from");
+    for (i = optind; i < argc; i++)
+	printf(" %s", argv[i]);
+    printf("\n * (%lu bytes prewarmed). Build mm.c with it through\n"
+	   " * \"make MM_PROFILE=<this file>\".\n */\n", (unsigned long)used);
+    printf("#define PROFILE_CHUNKSIZE  %u\n", chunk);
+    printf("#define PROFILE_NSIZES     %d\n", nchosen);
+    if (nchosen > 0) {
+	printf("#define PROFILE_SIZES      {");
+	for (i = 0; i < nchosen; i++)
+	    printf("%s%u", i ? ", " : " ", chosen[i].asize);
+	printf(" }\n#define PROFILE_COUNTS     {");
+	for (i = 0; i < nchosen; i++)
+	    printf("%s%u", i ? ", " : " ", chosen[i].count);
+	printf(" }\n");
+    }
+    free(asizes);
+    exit(0);
+}
+
+/*
+ * read_trace - Replay the requests of one trace, counting the blocks
+ *     of each size. Only the first window ops (all if 0) count towards
+ *     the peaks.
+ */
+static void read_trace(char *path, int window)
+{
+    FILE *tracefile;
+    char type[MAXLINE];
+    unsigned int heapsize, num_ids, num_ops, weight;
+    unsigned int index, size, op;
+    unsigned int *ids;         /* block size of each id, 0 if not live */
+
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	fprintf(stderr, "mkprofile: could not open %s\n", path);
+	exit(1);
+    }
+    if (fscanf(tracefile, "%u %u %u %u", &heapsize, &num_ids, &num_ops, &weight) != 4) {
+	fprintf(stderr, "mkprofile: %s is not a trace\n", path);
+	exit(1);
+    }
+    if ((ids = calloc(num_ids, sizeof(unsigned int))) == NULL) {
+	perror("mkprofile: calloc");
+	exit(1);
+    }
+
+    for (op = 0; fscanf(tracefile, "%s", type) != EOF; op++) {
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(tracefile, "%u %u", &index, &size) != 2 || index >= num_ids)
+		break;
+	    if (ids[index] != 0)
+		adjust(ids[index], -1, 0);
+	    ids[index] = ASIZE(size);
+	    adjust(ids[index], 1, window == 0 || op < window);
+	    add_asize(ids[index]);
+	    break;
+	case 'f':
+	    if (fscanf(tracefile, "%u", &index) != 1 || index >= num_ids)
+		break;
+	    if (ids[index] != 0)
+		adjust(ids[index], -1, 0);
+	    ids[index] = 0;
+	    break;
+	case 'b': /* Barriers and thread ids of threaded traces don't matter */
+	    op--;
+	    break;
+	default:
+	    if (isdigit((unsigned char)type[0])) {
+		op--;
+		break;
+	    }
+	    fprintf(stderr, "mkprofile: bogus type character (%c) in %s\n",
+		    type[0], path);
+	    exit(1);
+	}
+    }
+    fclose(tracefile);
+
+    /* Blocks still live at the end do not carry over to the next trace */
+    for (index = 0; index <= SMALL_MAX/DSIZE; index++)
+	stats[index].live = 0;
+    free(ids);
+}
+
+/*
+ * add_asize - Remember the block size of one request
+ */
+static void add_asize(unsigned int asize)
+{
+    if (nasizes == maxasizes) {
+	maxasizes = maxasizes ? 2 * maxasizes : 4096;
+	if ((asizes = realloc(asizes, maxasizes * sizeof(unsigned int))) == NULL) {
+	    perror("mkprofile: realloc");
+	    exit(1);
+	}
+    }
+    asizes[nasizes++] = asize;
+}
+
+/*
+ * adjust - Count a block of asize bytes coming (delta 1) or going
+ *     (delta -1). A new block raises the peak only if counted.
+ */
+static void adjust(unsigned int asize, int delta, int counted)
+{
+    sizestat_t *s;
+
+    if (asize > SMALL_MAX)
+	return;
+    s = &stats[asize / DSIZE];
+    s->live += delta;
+    if (delta > 0) {
+	s->allocs++;
+	if (counted && s->live > s->peak)
+	    s->peak = s->live;
+    }
+}
+
+static int by_allocs(const void *a, const void *b)
+{
+    const sizestat_t *x = a, *y = b;
+
+    return (x->allocs < y->allocs) - (x->allocs > y->allocs);
+}
+
+static int by_asize(const void *a, const void *b)
+{
+    const sizestat_t *x = a, *y = b;
+
+    return (x->asize > y->asize) - (x->asize < y->asize);
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mkprofile [-h] [-n <ops>] [-b <bytes>] [-k <n>] <trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <bytes> Prewarm at most <bytes> (default 256K).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-k <n>     Prewarm at most <n> block sizes (default 16).\n");
+    fprintf(stderr, "\t-n <ops>   Only the first <ops> requests of each trace count\n");
+    fprintf(stderr, "\t           as start-up (default all of them).\n");
+}
@@ -45,12 +45,26 @@
  * You will need to exceed the performance of this implicit first-fit placement
  * (which is about 54/100).
  */
+#define _GNU_SOURCE     /* for sched_getcpu */
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#ifdef __has_include
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#endif
+#endif
 #include "mm.h"
 #include "memlib.h"
+#ifdef MM_PROFILE
+#include MM_PROFILE     /* size profile written by mkprofile */
+#endif
 
 /* Team structure */
 /*********************************************************
@@ -78,7 +92,11 @@ team_t team = {
 /* Basic constants and macros */
 #define WSIZE       4       /* word size (bytes) */  
 #define DSIZE       8       /* doubleword size (bytes) */
+#ifdef PROFILE_CHUNKSIZE
+#define CHUNKSIZE  PROFILE_CHUNKSIZE  /* initial heap size (bytes) */
+#else
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
+#endif
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
@@ -87,8 +105,8 @@ team_t team = {
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p)       (*(size_t *)(p))
-#define PUT(p, val)  (*(size_t *)(p) = (val))  
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))  
 
 /* (which is about 54/100).* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
@@ -107,15 +125,218 @@ team_t team = {
 #define PRE_PTR(block_ptr) ((void *)(block_ptr)) 				//Predecessor of BP
 #define SUC_PTR(block_ptr) ((void *)(block_ptr + WSIZE)) 		//pointer to successor of BP
 
-#define PREV(block_ptr) (*(void **)(block_ptr))
-#define SUCC(block_ptr) (*(void **)(SUC_PTR(block_ptr)))
+/* 
+ * Free list links are stored as offsets from the start of the heap (0
+ * standing for NULL, as the roots sit there), so that every process
+ * sharing a heap can follow them wherever it has the heap mapped.
+ */
+#define PTR2OFF(p)  ((p) == NULL ? 0 : (unsigned int)((char *)(p) - m_heap->base))
+#define OFF2PTR(o)  ((o) == 0 ? NULL : (void *)(m_heap->base + (o)))
+
+#define PREV(block_ptr) OFF2PTR(GET(PRE_PTR(block_ptr)))
+#define SUCC(block_ptr) OFF2PTR(GET(SUC_PTR(block_ptr)))
+#define SET_PREV(block_ptr, p) PUT(PRE_PTR(block_ptr), PTR2OFF(p))
+#define SET_SUCC(block_ptr, p) PUT(SUC_PTR(block_ptr), PTR2OFF(p))
 
 /* $end mallocmacros */
 
+/* 
+ * The placement policy (first fit on LIFO segregated lists) and the
+ * block header are fixed here: heap files, shared heaps and checkpoints
+ * (mm_attach, mm_snapshot) store the 4-byte tags and 32-bit offset
+ * links as they are, and purging, the per-CPU caches and mm_checkheap
+ * rely on no two free blocks ever being adjacent. Other layouts and
+ * policies are combinations of mm::Allocator in mm_policy.hpp.
+ */
+
+/* 
+ * Free blocks sit on one of NCLASSES lists by size class. Up to 128
+ * bytes there is a class every DSIZE, and above that each power of two
+ * is split into four. CLASS_OF is a few branch-free instructions around
+ * a count of leading zeros for blocks over 128 bytes; blocks of up to
+ * SMALL_MAX bytes do not even pay that, as the preprocessor expands
+ * CLASS_OF into the class_of_small table at compile time.
+ */
+#define SMALL_MAX    4096
+#define NCLASSES     115        /* CLASS_OF of the largest 32-bit size, plus 1 */
+#define CLASSWORDS   ((NCLASSES + 31) / 32)
+
+#define CLASS_LG(s)  (31 - __builtin_clz((unsigned int)(s) - 1))
+#define CLASS_OF_LARGE(s) \
+    (15 + (CLASS_LG(s) - 7)*4 + ((((unsigned int)(s) - 1) >> (CLASS_LG(s) - 2)) & 3))
+#define CLASS_OF(s)  ((s) < 2*DSIZE ? 0 : (s) <= 128 ? (s)/DSIZE - 2 : CLASS_OF_LARGE(s))
+
+/* Smallest block size of class c */
+#define CLASS_MIN(c) ((c) < 15 ? ((c)+2)*DSIZE : \
+    (128u << (((c)-15)/4)) + (((c)-15)%4)*(32u << (((c)-15)/4)) + DSIZE)
+
+/* 
+ * Heap roots. They live at the very start of the heap rather than in
+ * globals so that a heap kept in a file (mem_init_file) or shared
+ * between processes (mem_init_shared) can be picked up by mm_attach.
+ */
+#define MM_MAGIC    0x6d6d5253  /* "mmRS", roots with segregated lists */
+
+typedef struct {
+    unsigned int magic;          /* MM_MAGIC once mm_init has run */
+    unsigned int flags;          /* MM_* flags from mm_init_flags */
+    unsigned int heap_list;      /* offset of first block */
+    unsigned int freelist[NCLASSES];     /* offset of the head of each class */
+    unsigned int nonempty[CLASSWORDS];   /* bit set of classes with free blocks */
+    int freecount;               /* number of blocks on the free lists */
+    unsigned int remote_free;    /* offset of the last block freed remotely */
+    unsigned int percpu;         /* offset of the per-CPU caches (MM_PERCPU) */
+    int ncpus;                   /* number of per-CPU caches */
+    unsigned int decay_ms;       /* age at which free pages are purged */
+    unsigned int warm[NCLASSES]; /* offset of the first prewarmed block of each class */
+    unsigned int warmcount;      /* prewarmed blocks not handed out yet */
+    pthread_mutex_t lock;        /* held around each request if MM_THREADSAFE */
+} mm_root_t;
+
+/* 
+ * With MM_PERCPU each CPU keeps a few free blocks of every small size
+ * class, still marked allocated in the heap. A thread claims its CPU's
+ * cache with one atomic exchange, so pushes and pops take no lock, and
+ * if the cache is already claimed (the other thread was preempted on
+ * this CPU) the request simply goes to the heap instead. A block sits
+ * in the class of its size, or, after mm_free_sized, in that of the
+ * size it was asked for, which is at most its own.
+ */
+#define PCPU_MAXSIZE 256                        /* largest cached block size */
+#define PCPU_CLASSES ((PCPU_MAXSIZE / DSIZE) - 1) /* 16, 24, ... 256 */
+#define PCPU_DEPTH   16                         /* cached blocks per class */
+#define PCPU_CLASS(asize) (((asize) / DSIZE) - 2)
+
+/* 
+ * With MM_LINEALIGN, blocks of LINESIZE bytes or more start on a cache
+ * line and fill whole lines, and smaller blocks are cut by each thread
+ * from a LINE_RUN of lines of its own, so no two threads ever write to
+ * the same line through their blocks.
+ */
+#define LINESIZE     64
+#define LINE_RUN     (8*LINESIZE)
+
+typedef struct {
+    unsigned int busy;                           /* claimed by a thread */
+    unsigned int count[PCPU_CLASSES];            /* blocks in each class */
+    unsigned int slot[PCPU_CLASSES][PCPU_DEPTH]; /* offsets of the blocks */
+} mm_pcpu_t;
+
+/*
+ * mm_free_deferred hands blocks to epoch-based reclamation. Readers
+ * bracket their read sections with mm_epoch_enter/mm_epoch_exit, which
+ * publish the global epoch they saw in the thread's record. A block
+ * deferred in epoch e is freed once the epoch has reached e+2, because
+ * by then every reader that might have seen it has left. Blocks wait in
+ * one of three limbo lists per thread, made of chunks of pointers that
+ * come from the heap itself (the payload of a deferred block may still
+ * be read, so it cannot hold the links), and are freed a chunk at a
+ * time under one lock. The epoch domain belongs to this process, even
+ * when the heap is shared, and is common to all its heaps; the limbo of
+ * a thread holds blocks of one heap at a time.
+ */
+#define EPOCH_THREADS 128  /* threads using epochs at the same time */
+#define EPOCH_BATCH   64   /* deferred frees per chunk and between reclaims */
+
+#define EPOCH_FREE     0   /* owner states of an epoch record */
+#define EPOCH_USED     1
+#define EPOCH_ORPHANED 2   /* its thread exited with blocks in limbo */
+#define EPOCH_DRAINING 3   /* another thread is freeing those blocks */
+
+typedef struct mm_limbo_t {
+    struct mm_limbo_t *next;       /* older chunk of the same list */
+    int count;                     /* blocks in ptrs */
+    void *ptrs[EPOCH_BATCH];
+} mm_limbo_t;
+
+typedef struct {
+    unsigned int owner;            /* EPOCH_* state of the record */
+    unsigned long active;          /* (epoch << 1) | 1 while reading, else 0 */
+    struct mm_heap *heap;          /* heap the limbo blocks belong to */
+    unsigned int heapgen;          /* its gen when they were deferred */
+    unsigned int ndeferred;        /* blocks deferred so far */
+    unsigned long limbo_epoch[3];  /* epoch the blocks in each list wait on */
+    mm_limbo_t *limbo[3];          /* blocks deferred in that epoch */
+} __attribute__((aligned(64))) mm_epoch_rec_t;
+
+/*
+ * Free blocks of PURGE_MINSIZE bytes or more carry the time they were
+ * freed (in ms, low bit clear) in the word after their links. mm_purge
+ * gives the whole pages inside those older than decay_ms back to the
+ * system through mem_purge, leaving header, links and footer alone, and
+ * sets the low bit so they are not purged again. The pages come back
+ * zeroed when the block is used again.
+ */
+#define PURGE_MINSIZE  (1<<13)
+#define STAMP(block_ptr)  ((char *)(block_ptr) + DSIZE)
+#define PURGED      0x1
+
+#define ROOTSIZE    ALIGN(sizeof(mm_root_t))
+
+#define HEAP_LIST() (m_heap->base + m_heap->root->heap_list)
+#define FREELIST(c) ((char *)OFF2PTR(m_heap->root->freelist[c]))
+
+#define LOCK()   do { if (m_heap->root->flags & MM_THREADSAFE) heap_lock(); } while (0)
+#define UNLOCK() do { if (m_heap->root->flags & MM_THREADSAFE) \
+                          pthread_mutex_unlock(&m_heap->root->lock); } while (0)
+
+/* 
+ * A heap as this process sees it. Each memlib context holds at most one
+ * heap, whose mm_heap_t is kept in the context's client slot. Slots of
+ * m_heaps are never given back to the system, only reused, so a stale
+ * pointer to one is caught by its gen rather than being dangling.
+ */
+#define MM_HEAPS    64      /* heaps in use at the same time */
+
+typedef struct mm_heap {
+    mem_ctx_t *mem;         /* memlib context holding the heap, NULL if free */
+    mm_root_t *root;        /* roots of the heap */
+    char *base;             /* where this process has the heap mapped */
+    pthread_t owner;        /* thread that set up or attached the heap */
+    unsigned int gen;       /* changes whenever the heap is replaced */
+    pthread_t purger;       /* background thread of mm_set_decay */
+    int purger_running;
+    int purger_stop;
+    pthread_mutex_t purger_lock;
+    pthread_cond_t purger_cond;
+} mm_heap_t;
+
+/* The size class tables, filled in by the preprocessor */
+#define CS1(i)   CLASS_OF((i)*DSIZE)
+#define CS4(i)   CS1(i), CS1((i)+1), CS1((i)+2), CS1((i)+3)
+#define CS16(i)  CS4(i), CS4((i)+4), CS4((i)+8), CS4((i)+12)
+#define CS64(i)  CS16(i), CS16((i)+16), CS16((i)+32), CS16((i)+48)
+#define CS256(i) CS64(i), CS64((i)+64), CS64((i)+128), CS64((i)+192)
+static const unsigned char class_of_small[SMALL_MAX/DSIZE + 1] = {
+    CS256(0), CS256(256), CS1(512)
+};
+
+#define CM1(c)   CLASS_MIN(c)
+#define CM4(c)   CM1(c), CM1((c)+1), CM1((c)+2), CM1((c)+3)
+#define CM16(c)  CM4(c), CM4((c)+4), CM4((c)+8), CM4((c)+12)
+static const unsigned int class_min[NCLASSES] = {
+    CM16(0), CM16(16), CM16(32), CM16(48), CM16(64), CM16(80), CM16(96),
+    CM1(112), CM1(113), CM1(114)
+};
+
 /* Global variables */
-static char *p_heap_list;  /* pointer to first block */  
-static char *mp_firstfreeblock;
-static int 	m_freecount;
+static mm_heap_t m_heaps[MM_HEAPS];
+static pthread_mutex_t m_heaps_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int m_heapgen;        /* last gen handed out */
+static __thread mm_heap_t *m_heap;    /* heap this thread is working on */
+
+/* The rest of this thread's current line run in each heap (MM_LINEALIGN) */
+static __thread struct {
+    unsigned int gen;       /* gen of the heap when the run was cut */
+    char *next;             /* allocated block holding the rest of the run */
+} m_run[MM_HEAPS];
+
+static unsigned long m_epoch = 1;                    /* global epoch */
+static mm_epoch_rec_t m_epoch_recs[EPOCH_THREADS];   /* one per thread */
+static pthread_key_t m_epoch_key;     /* releases a record at thread exit */
+static pthread_once_t m_epoch_once = PTHREAD_ONCE_INIT;
+static __thread mm_epoch_rec_t *m_epoch_rec;  /* this thread's record */
+static __thread int m_epoch_depth;            /* nesting of read sections */
 
 /* function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
@@ -126,6 +347,37 @@ static void printblock(void *block_ptr);
 static void checkblock(void *block_ptr);
 static void allocate_block(void * block_ptr);
 static void free_block(void * block_ptr);
+static unsigned int size_class(size_t size);
+static unsigned int next_class(unsigned int c);
+static void heap_lock(void);
+static mm_heap_t *heap_claim(mem_ctx_t *ctx);
+static void heap_use(mem_ctx_t *ctx);
+static void *malloc_unlocked(size_t size);
+static void free_unlocked(void *block_ptr);
+static void free_shared(void *block_ptr);
+static void remote_free_push(void *block_ptr);
+static int remote_free_drain(void);
+static int percpu_init(void);
+static mm_pcpu_t *percpu_claim(void);
+static void *percpu_take(size_t size, size_t align);
+static size_t aligned_gap(void *block_ptr, size_t align);
+static void *find_fit_aligned(size_t asize, size_t align);
+static void *place_aligned(void *block_ptr, size_t asize, size_t align);
+static void *malloc_aligned_unlocked(size_t size, size_t align);
+static void *line_run_alloc(size_t asize);
+static mm_epoch_rec_t *epoch_rec(void);
+static void epoch_key_init(void);
+static void epoch_thread_exit(void *arg);
+static int epoch_try_advance(void);
+static mm_limbo_t *epoch_chunk(mm_epoch_rec_t *rec);
+static void epoch_reclaim(mm_epoch_rec_t *rec);
+static void epoch_free_chain(mm_limbo_t *chunk);
+static void epoch_synchronize(void);
+static unsigned int now_ms(void);
+static void *purger(void *arg);
+static void purger_stop(void);
+static int prewarm(void);
+static void *warm_take(size_t asize);
 
 /* 
  * mm_init - Initialize the memory manager 
@@ -140,37 +392,347 @@ Init - End
 /* $begin mminit */
 int mm_init(void) 
 {
-    /* create the initial empty heap */
-    if ((p_heap_list = mem_sbrk(4*WSIZE)) == NULL) return -1;
+    return mm_init_flags(0);
+}
+
+/*
+ * The functions without a context work on memlib's default one, which
+ * is what mdriver and the rest of the existing callers use.
+ */
+int mm_init_flags(int flags)
+{
+    return mm_ctx_init_flags(mem_default_ctx(), flags);
+}
+
+int mm_attach(void)
+{
+    return mm_ctx_attach(mem_default_ctx());
+}
+
+int mm_reset(void)
+{
+    return mm_ctx_reset(mem_default_ctx());
+}
+
+int mm_snapshot(FILE *fp)
+{
+    return mm_ctx_snapshot(mem_default_ctx(), fp);
+}
+
+int mm_restore(FILE *fp)
+{
+    return mm_ctx_restore(mem_default_ctx(), fp);
+}
+
+void *mm_malloc(size_t size)
+{
+    return mm_ctx_malloc(mem_default_ctx(), size);
+}
+
+void mm_free(void *ptr)
+{
+    mm_ctx_free(mem_default_ctx(), ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return mm_ctx_realloc(mem_default_ctx(), ptr, size);
+}
+
+void mm_free_batch(void **ptrs, int n)
+{
+    mm_ctx_free_batch(mem_default_ctx(), ptrs, n);
+}
+
+void *mm_memalign(size_t align, size_t size)
+{
+    return mm_ctx_memalign(mem_default_ctx(), align, size);
+}
+
+void mm_free_sized(void *ptr, size_t size)
+{
+    mm_ctx_free_sized(mem_default_ctx(), ptr, size);
+}
+
+void mm_free_deferred(void *ptr)
+{
+    mm_ctx_free_deferred(mem_default_ctx(), ptr);
+}
+
+int mm_set_decay(unsigned int ms)
+{
+    return mm_ctx_set_decay(mem_default_ctx(), ms);
+}
+
+size_t mm_purge(void)
+{
+    return mm_ctx_purge(mem_default_ctx());
+}
+
+void mm_lock(void)
+{
+    mm_ctx_lock(mem_default_ctx());
+}
+
+void mm_unlock(void)
+{
+    mm_ctx_unlock(mem_default_ctx());
+}
+
+void mm_checkheap(int verbose)
+{
+    mm_ctx_checkheap(mem_default_ctx(), verbose);
+}
+
+/*
+ * mm_ctx_init_flags - mm_init with options, building the heap in the
+ *     memlib context ctx: MM_THREADSAFE lets several threads use the
+ *     heap, and MM_REMOTE_FREE additionally turns frees from threads
+ *     other than the caller into a lock-free push on a queue that is
+ *     drained the next time a malloc finds no fit. A heap in shared
+ *     memory is always MM_THREADSAFE. Returns -1 if it fails or if
+ *     MM_HEAPS heaps are already in use.
+ */
+int mm_ctx_init_flags(mem_ctx_t *ctx, int flags)
+{
+    char *p_heap_list;
+    pthread_mutexattr_t attr;
+
+    if (heap_claim(ctx) == NULL) return -1;
+    purger_stop();
+
+    /* create the roots and the initial empty heap */
+    if ((m_heap->root = mem_ctx_sbrk(ctx, ROOTSIZE + 4*WSIZE)) == (void *)-1) return -1;
+    m_heap->base = (char *)m_heap->root;
+    p_heap_list = (char *)m_heap->root + ROOTSIZE;
     PUT(p_heap_list, 0);                        /* alignment padding */
     PUT(p_heap_list+WSIZE, PACK(OVERHEAD, 1));  /* prologue header */ 
     PUT(p_heap_list+DSIZE, PACK(OVERHEAD, 1));  /* prologue footer */ 
     PUT(p_heap_list+WSIZE+DSIZE, PACK(0, 1));   /* epilogue header */
     p_heap_list += DSIZE;
-    mp_firstfreeblock = p_heap_list;
-    m_freecount = 0;
+    if (mem_ctx_is_shared(ctx) || (flags & (MM_REMOTE_FREE | MM_PERCPU | MM_LINEALIGN)))
+    {
+        flags |= MM_THREADSAFE;
+    }
+    m_heap->root->flags = flags;
+    m_heap->root->heap_list = p_heap_list - m_heap->base;
+    memset(m_heap->root->freelist, 0, sizeof(m_heap->root->freelist));
+    memset(m_heap->root->nonempty, 0, sizeof(m_heap->root->nonempty));
+    m_heap->root->freecount = 0;
+    m_heap->root->remote_free = 0;
+    m_heap->root->percpu = 0;
+    m_heap->root->decay_ms = 0;
+    memset(m_heap->root->warm, 0, sizeof(m_heap->root->warm));
+    m_heap->root->warmcount = 0;
+    m_heap->owner = pthread_self();
+    m_heap->gen = __atomic_add_fetch(&m_heapgen, 1, __ATOMIC_RELAXED);
+
+    /* Other processes may come and go, so a shared lock has to be robust */
+    if (flags & MM_THREADSAFE)
+    {
+        pthread_mutexattr_init(&attr);
+        if (mem_ctx_is_shared(ctx))
+        {
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        }
+        pthread_mutex_init(&m_heap->root->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    m_heap->root->magic = MM_MAGIC;
 	
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL) return -1;
+    if (prewarm() < 0) return -1;
 
-//    PUT((SUCC(mp_firstfreeblock)+WSIZE), (int)NULL);
-//    PUT((PREV(mp_firstfreeblock)+WSIZE), (int)NULL);
-    SUCC(mp_firstfreeblock + WSIZE) = NULL;
-    PREV(mp_firstfreeblock + WSIZE) = NULL;
-
+    if ((flags & MM_PERCPU) && percpu_init() < 0) return -1;
 
     return 0;
 }
 /* $end mminit */
 
+/*
+ * mm_ctx_attach - Adopt the heap already present in the region of ctx,
+ *     e.g. one reopened by mem_init_file or mem_init_shared, instead of
+ *     building a new one. Links are heap offsets, so it does not matter
+ *     where the region is mapped. Returns -1 if it holds no heap.
+ */
+int mm_ctx_attach(mem_ctx_t *ctx)
+{
+    mm_root_t *root = mem_ctx_heap_lo(ctx);
+
+    if (mem_ctx_heapsize(ctx) < ROOTSIZE + 4*WSIZE || root->magic != MM_MAGIC ||
+        heap_claim(ctx) == NULL)
+    {
+        return -1;
+    }
+    m_heap->root = root;
+    m_heap->base = (char *)root;
+    m_heap->owner = pthread_self();
+    m_heap->gen = __atomic_add_fetch(&m_heapgen, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * mm_ctx_detach - Forget the heap of ctx, e.g. before the context is
+ *     freed. The region itself is left alone, so a heap in a file or in
+ *     shared memory can be attached again later.
+ */
+void mm_ctx_detach(mem_ctx_t *ctx)
+{
+    mm_heap_t *heap = *mem_ctx_client(ctx);
+
+    if (heap == NULL)
+    {
+        return;
+    }
+    m_heap = heap;
+    purger_stop();
+    pthread_mutex_destroy(&heap->purger_lock);
+    pthread_cond_destroy(&heap->purger_cond);
+    heap->gen = __atomic_add_fetch(&m_heapgen, 1, __ATOMIC_RELAXED);
+    *mem_ctx_client(ctx) = NULL;
+    m_heap = NULL;
+
+    pthread_mutex_lock(&m_heaps_lock);
+    heap->root = NULL;
+    heap->mem = NULL;
+    pthread_mutex_unlock(&m_heaps_lock);
+}
+
+/*
+ * mm_ctx_reset - Drop every allocation at once and go back to the state
+ *     mm_init leaves behind: one free CHUNKSIZE block on an otherwise
+ *     empty free list. The roots, lock and prologue stay as they are
+ *     and the heap pages stay mapped, so without a size profile this
+ *     takes constant time, plus clearing one per-CPU cache per CPU with
+ *     MM_PERCPU. With MM_PROFILE it carves the prewarmed blocks again,
+ *     which takes time linear in their number.
+ *     Returns -1 if ctx has no heap set up by mm_init to reset.
+ */
+int mm_ctx_reset(mem_ctx_t *ctx)
+{
+    char *block_ptr;
+
+    if ((m_heap = *mem_ctx_client(ctx)) == NULL || m_heap->root == NULL ||
+        (void *)m_heap->root != mem_ctx_heap_lo(ctx) || m_heap->root->magic != MM_MAGIC)
+    {
+        return -1;
+    }
+
+    LOCK();
+    mem_ctx_reset_brk(ctx);
+    if (mem_ctx_sbrk(ctx, ROOTSIZE + 4*WSIZE + CHUNKSIZE) == (void *)-1)
+    {
+        UNLOCK();
+        return -1;
+    }
+    block_ptr = HEAP_LIST() + DSIZE;
+    PUT(HDRP(block_ptr), PACK(CHUNKSIZE, 0));
+    PUT(FTRP(block_ptr), PACK(CHUNKSIZE, 0));
+    PUT(HDRP(NEXT_BLKP(block_ptr)), PACK(0, 1));
+    memset(m_heap->root->freelist, 0, sizeof(m_heap->root->freelist));
+    memset(m_heap->root->nonempty, 0, sizeof(m_heap->root->nonempty));
+    m_heap->root->freecount = 0;
+    memset(m_heap->root->warm, 0, sizeof(m_heap->root->warm));
+    m_heap->root->warmcount = 0;
+    free_block(block_ptr);
+    if (prewarm() < 0)
+    {
+        UNLOCK();
+        return -1;
+    }
+    m_heap->root->remote_free = 0;
+    m_heap->gen = __atomic_add_fetch(&m_heapgen, 1, __ATOMIC_RELAXED);
+    if ((m_heap->root->flags & MM_PERCPU) && percpu_init() < 0)
+    {
+        UNLOCK();
+        return -1;
+    }
+    UNLOCK();
+    return 0;
+}
+
+/*
+ * mm_ctx_snapshot - Write the heap to fp so that mm_restore can bring it
+ *     back later. The roots live inside the heap, so the memlib region
+ *     is the whole state. Returns -1 on a write error.
+ */
+int mm_ctx_snapshot(mem_ctx_t *ctx, FILE *fp)
+{
+    size_t size = mem_ctx_heapsize(ctx);
+
+    if (fwrite(&size, sizeof(size), 1, fp) != 1 ||
+        fwrite(mem_ctx_heap_lo(ctx), 1, size, fp) != size)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * mm_ctx_restore - Replace the heap with one saved by mm_snapshot and
+ *     adopt it. Returns -1 if fp does not hold a usable snapshot; once
+ *     the old heap has been overwritten, ctx then holds no heap at all
+ *     until mm_init or mm_restore succeeds.
+ */
+int mm_ctx_restore(mem_ctx_t *ctx, FILE *fp)
+{
+    size_t size;
+
+    if (fread(&size, sizeof(size), 1, fp) != 1)
+    {
+        return -1;
+    }
+    if ((m_heap = *mem_ctx_client(ctx)) != NULL)
+    {
+        purger_stop();
+    }
+    mem_ctx_reset_brk(ctx);
+    if (mem_ctx_sbrk(ctx, size) == (void *)-1 || fread(mem_ctx_heap_lo(ctx), 1, size, fp) != size ||
+        mm_ctx_attach(ctx) < 0)
+    {
+        /* Drop the old heap and spoil what may look like a new one */
+        mm_ctx_detach(ctx);
+        if (mem_ctx_heapsize(ctx) >= ROOTSIZE)
+        {
+            ((mm_root_t *)mem_ctx_heap_lo(ctx))->magic = 0;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* 
+ * mm_ctx_malloc - Allocate a block with at least size bytes of payload 
+ */
+void *mm_ctx_malloc(mem_ctx_t *ctx, size_t size)
+{
+    void *block_ptr;
+
+    heap_use(ctx);
+
+    /* Small requests first try the cache of the CPU we are on */
+    if ((block_ptr = percpu_take(size, DSIZE)) != NULL)
+    {
+        return block_ptr;
+    }
+
+    LOCK();
+    block_ptr = malloc_unlocked(size);
+    UNLOCK();
+    return block_ptr;
+}
+
 /* 
- * mm_malloc - Allocate a block with at least size bytes of payload 
+ * malloc_unlocked - mm_malloc for callers that already hold the lock
  */
 /* $begin mmmalloc */
-void *mm_malloc(size_t size) 
+static void *malloc_unlocked(size_t size) 
 {
     size_t asize;      /* adjusted block size */
     size_t extendsize; /* amount to extend heap if no fit */
+    size_t hsize;      /* huge page size of the heap, if any */
     char *block_ptr;      
 //printf("enter malloc \n");
     /* Ignore spurious requests */
@@ -185,9 +747,36 @@ void *mm_malloc(size_t size)
 	{
 	        asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE);
 	}
+
+    /* Huge blocks start on a huge page if the heap has them */
+    if ((hsize = mem_ctx_hugepagesize(m_heap->mem)) != 0 && size >= hsize)
+	{
+        return malloc_aligned_unlocked(size, hsize);
+	}
+
+    /* Keep blocks of different threads on different cache lines */
+    if (m_heap->root->flags & MM_LINEALIGN)
+	{
+        if (size >= LINESIZE)
+		{
+            return malloc_aligned_unlocked((size + LINESIZE-1) & ~(LINESIZE-1), LINESIZE);
+		}
+        return line_run_alloc(asize);
+	}
+
+    /* Blocks of the size profile go out first */
+    if (m_heap->root->warmcount > 0 && (block_ptr = warm_take(asize)) != NULL)
+	{
+        return block_ptr;
+	}
     
-    /* Search the free list for a fit */
+    /* Search the free list for a fit, then again with remote frees */
 	block_ptr = find_fit(asize);
+    if (block_ptr == NULL && __atomic_load_n(&m_heap->root->remote_free, __ATOMIC_RELAXED) != 0 &&
+        remote_free_drain() > 0)
+	{
+        block_ptr = find_fit(asize);
+	}
     if (block_ptr != NULL) 
 	{
 
@@ -212,10 +801,58 @@ void *mm_malloc(size_t size)
 /* $end mmmalloc */
 
 /* 
- * mm_free - Free a block 
+ * mm_ctx_free - Free a block 
+ */
+void mm_ctx_free(mem_ctx_t *ctx, void *block_ptr)
+{
+    size_t size;
+    mm_pcpu_t *pcpu;
+
+    heap_use(ctx);
+
+    /* Small blocks go back to this CPU's cache while it has room */
+    if ((m_heap->root->flags & MM_PERCPU) && (size = GET_SIZE(HDRP(block_ptr))) <= PCPU_MAXSIZE)
+    {
+        if ((pcpu = percpu_claim()) != NULL)
+        {
+            if (pcpu->count[PCPU_CLASS(size)] < PCPU_DEPTH)
+            {
+                pcpu->slot[PCPU_CLASS(size)][pcpu->count[PCPU_CLASS(size)]++] =
+                    PTR2OFF(block_ptr);
+                block_ptr = NULL;
+            }
+            __atomic_store_n(&pcpu->busy, 0, __ATOMIC_RELEASE);
+            if (block_ptr == NULL)
+            {
+                return;
+            }
+        }
+    }
+
+    free_shared(block_ptr);
+}
+
+/* 
+ * free_shared - Give a block back to the heap itself, or queue it for
+ *               the owner thread with MM_REMOTE_FREE
+ */
+static void free_shared(void *block_ptr)
+{
+    if ((m_heap->root->flags & MM_REMOTE_FREE) && !pthread_equal(pthread_self(), m_heap->owner))
+    {
+        remote_free_push(block_ptr);
+        return;
+    }
+    LOCK();
+    free_unlocked(block_ptr);
+    UNLOCK();
+}
+
+/* 
+ * free_unlocked - mm_free for callers that already hold the lock
  */
 /* $begin mmfree */
-void mm_free(void *block_ptr)
+static void free_unlocked(void *block_ptr)
 {
     size_t size = GET_SIZE(HDRP(block_ptr));
 
@@ -229,17 +866,268 @@ void mm_free(void *block_ptr)
 /* $end mmfree */
 
 /*
- * mm_realloc - naive implementation of mm_realloc
+ * mm_ctx_free_batch - Free n blocks, taking the lock once for all of them
  */
-void *mm_realloc(void *ptr, size_t size)
+void mm_ctx_free_batch(mem_ctx_t *ctx, void **ptrs, int n)
+{
+    int i;
+
+    heap_use(ctx);
+    LOCK();
+    for (i = 0; i < n; i++)
+	{
+        if (ptrs[i] != NULL)
+		{
+            free_unlocked(ptrs[i]);
+		}
+	}
+    UNLOCK();
+}
+
+/*
+ * mm_ctx_memalign - Allocate a block of at least size bytes whose
+ *                   payload starts on an align boundary. align must be
+ *                   a power of two; NULL is returned otherwise.
+ */
+void *mm_ctx_memalign(mem_ctx_t *ctx, size_t align, size_t size)
+{
+    void *block_ptr;
+
+    if (align & (align - 1))
+	{
+        return NULL;
+	}
+    if (align <= DSIZE)
+	{
+        return mm_ctx_malloc(ctx, size);
+	}
+    if (size == 0)
+	{
+        return NULL;
+	}
+
+    heap_use(ctx);
+    if ((block_ptr = percpu_take(size, align)) != NULL)
+    {
+        return block_ptr;
+    }
+    LOCK();
+    block_ptr = malloc_aligned_unlocked(size, align);
+    UNLOCK();
+    return block_ptr;
+}
+
+/*
+ * mm_ctx_free_sized - Free a block whose requested size the caller
+ *                     still knows, as C++ sized deallocation does. With
+ *                     MM_PERCPU a small block goes to the cache class of
+ *                     that size without its header being read.
+ */
+void mm_ctx_free_sized(mem_ctx_t *ctx, void *ptr, size_t size)
+{
+    size_t asize;
+    mm_pcpu_t *pcpu;
+
+    heap_use(ctx);
+
+    if (!(m_heap->root->flags & MM_PERCPU) || size > PCPU_MAXSIZE - OVERHEAD)
+    {
+        mm_ctx_free(ctx, ptr);
+        return;
+    }
+
+    asize = (size <= DSIZE) ? DSIZE + OVERHEAD : ALIGN(size + OVERHEAD);
+    if ((pcpu = percpu_claim()) != NULL)
+    {
+        if (pcpu->count[PCPU_CLASS(asize)] < PCPU_DEPTH)
+        {
+            pcpu->slot[PCPU_CLASS(asize)][pcpu->count[PCPU_CLASS(asize)]++] = PTR2OFF(ptr);
+            ptr = NULL;
+        }
+        __atomic_store_n(&pcpu->busy, 0, __ATOMIC_RELEASE);
+        if (ptr == NULL)
+        {
+            return;
+        }
+    }
+    free_shared(ptr);
+}
+
+/*
+ * mm_epoch_enter - Start a read section. Blocks passed to
+ *                  mm_free_deferred stay valid until every section
+ *                  that was open at the time has been left. Sections
+ *                  nest. Returns -1 if there are too many threads.
+ */
+int mm_epoch_enter(void)
+{
+    mm_epoch_rec_t *rec = epoch_rec();
+
+    if (rec == NULL)
+	{
+        return -1;
+	}
+    if (m_epoch_depth++ == 0)
+	{
+        __atomic_store_n(&rec->active, (__atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE) << 1) | 1,
+                         __ATOMIC_SEQ_CST);
+	}
+    return 0;
+}
+
+/*
+ * mm_epoch_exit - Leave the read section started by mm_epoch_enter
+ */
+void mm_epoch_exit(void)
+{
+    if (m_epoch_rec != NULL && m_epoch_depth > 0 && --m_epoch_depth == 0)
+	{
+        __atomic_store_n(&m_epoch_rec->active, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * mm_ctx_free_deferred - Free a block once no read section can still
+ *                        be using it. Every EPOCH_BATCH calls the thread
+ *                        tries to advance the epoch and frees what has
+ *                        become safe. Without a record (too many threads)
+ *                        or room for one more limbo chunk it waits for
+ *                        the readers and frees the block right away, and
+ *                        it waits for them as well the first time a
+ *                        block of another heap follows blocks still in
+ *                        limbo, so then it must not be called inside a
+ *                        read section.
+ */
+void mm_ctx_free_deferred(mem_ctx_t *ctx, void *ptr)
+{
+    mm_epoch_rec_t *rec;
+    mm_limbo_t *chunk;
+
+    heap_use(ctx);
+    if (ptr == NULL)
+	{
+        return;
+	}
+    if ((rec = epoch_rec()) == NULL || (chunk = epoch_chunk(rec)) == NULL)
+	{
+        epoch_synchronize();
+        mm_ctx_free(ctx, ptr);
+        return;
+	}
+    chunk->ptrs[chunk->count++] = ptr;
+
+    if (++rec->ndeferred % EPOCH_BATCH == 0)
+	{
+        epoch_try_advance();
+        epoch_reclaim(rec);
+	}
+}
+
+/*
+ * mm_ctx_set_decay - Purge the pages of large free blocks once they
+ *                    have been free for ms milliseconds (0 turns purging
+ *                    off). A MM_THREADSAFE heap gets a background thread
+ *                    that runs mm_purge every ms/2; otherwise the caller
+ *                    has to call mm_purge now and then. Returns -1 if
+ *                    the thread cannot be started.
+ */
+int mm_ctx_set_decay(mem_ctx_t *ctx, unsigned int ms)
+{
+    heap_use(ctx);
+    purger_stop();
+    m_heap->root->decay_ms = ms;
+    if (ms == 0 || !(m_heap->root->flags & MM_THREADSAFE))
+	{
+        return 0;
+	}
+    m_heap->purger_stop = 0;
+    if (pthread_create(&m_heap->purger, NULL, purger, m_heap) != 0)
+	{
+        return -1;
+	}
+    m_heap->purger_running = 1;
+    return 0;
+}
+
+/*
+ * mm_ctx_purge - Give back the pages of every large free block that
+ *                has been free for the decay time. Returns the bytes
+ *                purged, which are none while purging is off.
+ */
+size_t mm_ctx_purge(mem_ctx_t *ctx)
+{
+    unsigned int now = now_ms(), stamp;
+    size_t pagesize = mem_pagesize(), purged = 0;
+    char *block_ptr, *lo, *hi;
+    unsigned int c;
+
+    heap_use(ctx);
+    if (m_heap->root->decay_ms == 0)
+	{
+        return 0;
+	}
+    LOCK();
+    for (c = size_class(PURGE_MINSIZE); (c = next_class(c)) < NCLASSES; c++)
+	{
+        for (block_ptr = FREELIST(c); block_ptr != NULL; block_ptr = SUCC(block_ptr))
+		{
+            if (GET_SIZE(HDRP(block_ptr)) < PURGE_MINSIZE)
+			{
+                continue;
+			}
+            stamp = GET(STAMP(block_ptr));
+            if ((stamp & PURGED) || now - stamp < m_heap->root->decay_ms)
+			{
+                continue;
+			}
+            lo = (char *)(((size_t)STAMP(block_ptr) + WSIZE + pagesize-1) & ~(pagesize-1));
+            hi = (char *)((size_t)FTRP(block_ptr) & ~(pagesize-1));
+            if (hi > lo)
+			{
+                mem_ctx_purge(ctx, lo, hi - lo);
+                purged += hi - lo;
+			}
+            PUT(STAMP(block_ptr), stamp | PURGED);
+		}
+	}
+    UNLOCK();
+    return purged;
+}
+
+/*
+ * mm_ctx_lock - Hold the lock of a MM_THREADSAFE heap until
+ *               mm_ctx_unlock, so that no other thread is inside the
+ *               allocator meanwhile; fork handlers use it to keep the
+ *               child from inheriting the lock held by a thread it
+ *               does not have.
+ */
+void mm_ctx_lock(mem_ctx_t *ctx)
+{
+    heap_use(ctx);
+    LOCK();
+}
+
+void mm_ctx_unlock(mem_ctx_t *ctx)
+{
+    heap_use(ctx);
+    UNLOCK();
+}
+
+/*
+ * mm_ctx_realloc - naive implementation of mm_realloc. Returns NULL,
+ *                  leaving ptr as it was, if there is no room.
+ */
+void *mm_ctx_realloc(mem_ctx_t *ctx, void *ptr, size_t size)
 {
     void *newp;
     size_t copySize;
 
-    if ((newp = mm_malloc(size)) == NULL) 
+    heap_use(ctx);
+    LOCK();
+    if ((newp = malloc_unlocked(size)) == NULL) 
 	{
-        printf("ERROR: mm_malloc failed in mm_realloc\n");
-        exit(1);
+        UNLOCK();
+        return NULL;
     }
     copySize = GET_SIZE(HDRP(ptr));
     if (size < copySize)
@@ -247,16 +1135,22 @@ void *mm_realloc(void *ptr, size_t size)
         copySize = size;
 	}
     memcpy(newp, ptr, copySize);
-    mm_free(ptr);
+    free_unlocked(ptr);
+    UNLOCK();
     return newp;
 }
 
 /* 
- * mm_checkheap - Check the heap for consistency 
+ * mm_ctx_checkheap - Check the heap for consistency 
  */
-void mm_checkheap(int verbose) 
+void mm_ctx_checkheap(mem_ctx_t *ctx, int verbose)
 {
-    char *block_ptr = p_heap_list;
+    char *p_heap_list, *block_ptr;
+    unsigned int c, size;
+    int nfree = 0;
+
+    heap_use(ctx);
+    p_heap_list = HEAP_LIST();
 
     if (verbose)
 	{
@@ -276,6 +1170,12 @@ void mm_checkheap(int verbose)
             printblock(block_ptr);
 		}
         checkblock(block_ptr);
+
+        /* Coalescing leaves no two free blocks next to each other */
+        if (!GET_ALLOC(HDRP(block_ptr)) && !GET_ALLOC(HDRP(NEXT_BLKP(block_ptr))))
+		{
+            printf("Error: %p and the next block are both free\n", block_ptr);
+		}
     }
  
     if (verbose)
@@ -286,6 +1186,44 @@ void mm_checkheap(int verbose)
 	{
         printf("Bad epilogue header\n");
 	}
+
+    /* Every block on a free list is free and on the list of its size */
+    for (c = 0; c < NCLASSES; c++)
+	{
+        for (block_ptr = FREELIST(c); block_ptr != NULL; block_ptr = SUCC(block_ptr))
+		{
+            size = GET_SIZE(HDRP(block_ptr));
+            if (GET_ALLOC(HDRP(block_ptr)) || size < class_min[c] ||
+                (c + 1 < NCLASSES && size >= class_min[c + 1]))
+			{
+                printf("Error: %p does not belong on free list %u\n", block_ptr, c);
+			}
+            nfree++;
+		}
+	}
+    if (nfree != m_heap->root->freecount)
+	{
+        printf("Error: %d blocks on the free lists, %d counted\n", nfree, m_heap->root->freecount);
+	}
+}
+
+/*
+ * mm_size_class - The free list class a request of size bytes is
+ *                 served from. It needs no heap; mdriver -c times it.
+ */
+unsigned int mm_size_class(size_t size)
+{
+    return size_class((size <= DSIZE) ? DSIZE + OVERHEAD : ALIGN(size + OVERHEAD));
+}
+
+/*
+ * mm_usable_size - The payload bytes of an allocated block, which may
+ *                  be more than were asked for. It reads only the
+ *                  block's header, so it needs no heap either.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    return GET_SIZE(HDRP(ptr)) - OVERHEAD;
 }
 
 /* The remaining routines are internal helper routines */
@@ -301,7 +1239,11 @@ static void *extend_heap(size_t words)
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if ((block_ptr = mem_sbrk(size)) == (void *)-1) 
+    if (mem_ctx_heapsize(m_heap->mem) + size > 0xffffffffUL)
+	{
+        return NULL;    /* beyond what a 32-bit offset can reach */
+	}
+    if ((block_ptr = mem_ctx_sbrk(m_heap->mem, size)) == (void *)-1) 
 	{
         return NULL;
 	}
@@ -352,28 +1294,156 @@ static void place(void *block_ptr, size_t asize)
 /* $end mmplace */
 
 /* 
- * find_fit - Find a fit for a block with asize bytes 
+ * find_fit - Find a fit for a block with asize bytes. Only blocks in
+ *            the class of asize can be too small, so the search ends in
+ *            the first class that has a fit.
  */
 static void *find_fit(size_t asize)
 {
-    /* first fit search */
-    void *block_ptr;
+    char *block_ptr;
+    unsigned int c;
 
-    for (block_ptr = mp_firstfreeblock; m_freecount >= 0; block_ptr = (SUCC(block_ptr))) 
+    for (c = size_class(asize); (c = next_class(c)) < NCLASSES; c++)
     {
-	if (block_ptr == NULL)
+        for (block_ptr = FREELIST(c); block_ptr != NULL; block_ptr = SUCC(block_ptr))
 	{
-		return NULL;
+            /* first fit search */
+            if (asize <= GET_SIZE(HDRP(block_ptr)))
+	    {
+                return block_ptr;
+	    }
 	}
-        if (!GET_ALLOC(HDRP(block_ptr)) && (asize <= GET_SIZE(HDRP(block_ptr)))) 
-	{
-            return block_ptr;
-        }
+    }
+    return NULL; /* no fit */
+}
+
+/*
+ * aligned_gap - Bytes to skip at the start of free block block_ptr for
+ *               the payload to land on an align boundary, leaving room
+ *               for a free block in front of it
+ */
+static size_t aligned_gap(void *block_ptr, size_t align)
+{
+    size_t gap = (align - ((size_t)block_ptr & (align-1))) & (align-1);
+
+    while (gap != 0 && gap < DSIZE + OVERHEAD)
+    {
+        gap += align;
+    }
+    return gap;
+}
+
+/* 
+ * find_fit_aligned - Find a fit for a block with asize bytes whose
+ *                    payload starts on an align boundary
+ */
+static void *find_fit_aligned(size_t asize, size_t align)
+{
+    void *block_ptr;
+    unsigned int c;
 
+    for (c = size_class(asize); (c = next_class(c)) < NCLASSES; c++)
+    {
+        for (block_ptr = FREELIST(c); block_ptr != NULL; block_ptr = SUCC(block_ptr))
+        {
+            if (aligned_gap(block_ptr, align) + asize <= GET_SIZE(HDRP(block_ptr)))
+            {
+                return block_ptr;
+            }
+        }
     }
     return NULL; /* no fit */
 }
 
+/*
+ * place_aligned - Split off the front of free block block_ptr as a free
+ *                 block of its own, so that a block of asize bytes can
+ *                 be placed on the next align boundary, and place it
+ */
+static void *place_aligned(void *block_ptr, size_t asize, size_t align)
+{
+    size_t gap = aligned_gap(block_ptr, align);
+    size_t csize = GET_SIZE(HDRP(block_ptr));
+
+    if (gap != 0)
+    {
+        allocate_block(block_ptr);
+        PUT(HDRP(block_ptr), PACK(gap, 0));
+        PUT(FTRP(block_ptr), PACK(gap, 0));
+        free_block(block_ptr);
+        block_ptr = (char *)block_ptr + gap;
+        PUT(HDRP(block_ptr), PACK(csize-gap, 0));
+        PUT(FTRP(block_ptr), PACK(csize-gap, 0));
+        free_block(block_ptr);
+    }
+    place(block_ptr, asize);
+    return block_ptr;
+}
+
+/*
+ * malloc_aligned_unlocked - Allocate a block of at least size bytes
+ *                           whose payload starts on an align boundary
+ *                           (a power of two). Called with the lock held.
+ */
+static void *malloc_aligned_unlocked(size_t size, size_t align)
+{
+    size_t asize = (size <= DSIZE) ? DSIZE + OVERHEAD : ALIGN(size + OVERHEAD);
+    void *block_ptr;
+
+    block_ptr = find_fit_aligned(asize, align);
+    if (block_ptr == NULL && __atomic_load_n(&m_heap->root->remote_free, __ATOMIC_RELAXED) != 0 &&
+        remote_free_drain() > 0)
+    {
+        block_ptr = find_fit_aligned(asize, align);
+    }
+    if (block_ptr == NULL &&
+        (block_ptr = extend_heap(MAX(asize + align + DSIZE + OVERHEAD, CHUNKSIZE)/WSIZE)) == NULL)
+    {
+        return NULL;
+    }
+    return place_aligned(block_ptr, asize, align);
+}
+
+/*
+ * line_run_alloc - Cut a small block off the front of this thread's
+ *                  line run, starting a new run when the rest is too
+ *                  short. The rest of the run is kept as an allocated
+ *                  block, so nobody else can place anything there.
+ */
+static void *line_run_alloc(size_t asize)
+{
+    int h = m_heap - m_heaps;
+    char *block_ptr = (m_run[h].gen == m_heap->gen) ? m_run[h].next : NULL;
+    size_t rsize = 0;
+
+    if (block_ptr != NULL && (rsize = GET_SIZE(HDRP(block_ptr))) < asize + DSIZE + OVERHEAD)
+    {
+        m_run[h].next = NULL;
+        if (rsize >= asize)
+        {
+            return block_ptr;       /* the rest of the run fits exactly */
+        }
+        free_unlocked(block_ptr);
+        block_ptr = NULL;
+    }
+    if (block_ptr == NULL)
+    {
+        if ((block_ptr = malloc_aligned_unlocked(LINE_RUN, LINESIZE)) == NULL)
+        {
+            return NULL;
+        }
+        rsize = GET_SIZE(HDRP(block_ptr));
+        m_run[h].gen = m_heap->gen;
+    }
+
+    PUT(HDRP(block_ptr), PACK(asize, 1));
+    PUT(FTRP(block_ptr), PACK(asize, 1));
+    m_run[h].next = NEXT_BLKP(block_ptr);
+    PUT(HDRP(m_run[h].next), PACK(rsize-asize, 1));
+    PUT(FTRP(m_run[h].next), PACK(rsize-asize, 1));
+    return block_ptr;
+}
+
 /*
  * coalesce - boundary tag coalescing. Return ptr to coalesced block
  */
@@ -458,7 +1528,7 @@ static void checkblock(void *block_ptr)
 static void printfree()
 {
     void *block_ptr;
-    for (block_ptr = p_heap_list; GET_SIZE(HDRP(block_ptr)) > 0; block_ptr = NEXT_BLKP(block_ptr))
+    for (block_ptr = HEAP_LIST(); GET_SIZE(HDRP(block_ptr)) > 0; block_ptr = NEXT_BLKP(block_ptr))
     {
 	size_t next_alloc = GET_ALLOC(HDRP((block_ptr)));
 	if(next_alloc == 0) printblock(block_ptr);
@@ -469,58 +1539,575 @@ static void printfree()
 
 static void free_block(void * block_ptr)
 {
-	m_freecount += 1;
+	unsigned int c = size_class(GET_SIZE(HDRP(block_ptr)));
+	char *first = FREELIST(c);
+
+	m_heap->root->freecount += 1;
+	m_heap->root->nonempty[c / 32] |= 1u << (c % 32);
+	if (GET_SIZE(HDRP(block_ptr)) >= PURGE_MINSIZE)
+		PUT(STAMP(block_ptr), now_ms() & ~PURGED);
+
+	SET_SUCC(block_ptr, first);
+	SET_PREV(block_ptr, NULL);
+	if (first != NULL)
+		SET_PREV(first, block_ptr);
+	m_heap->root->freelist[c] = PTR2OFF(block_ptr);
+}
 
-	if ((mp_firstfreeblock == p_heap_list) || mp_firstfreeblock == NULL){
-		SUCC(block_ptr) = NULL;
-		PREV(block_ptr) = NULL;
-		mp_firstfreeblock = block_ptr;
-		return;
+/*
+ * allocate_block - Take free block block_ptr off its list. Its header
+ *                  must still hold the size it was freed with.
+ */
+static void allocate_block(void * block_ptr)
+{
+	unsigned int c = size_class(GET_SIZE(HDRP(block_ptr)));
+	void *pp = PREV(block_ptr);
+	void *np = SUCC(block_ptr);
+
+	m_heap->root->freecount -= 1;
+	if (pp == NULL)
+	{
+		m_heap->root->freelist[c] = PTR2OFF(np);
+		if (np == NULL)
+			m_heap->root->nonempty[c / 32] &= ~(1u << (c % 32));
 	}
-	SUCC(block_ptr) = mp_firstfreeblock;
-	PREV(block_ptr) = NULL;
+	else
+		SET_SUCC(pp, np);
+	if (np != NULL)
+		SET_PREV(np, pp);
 
-	PREV(mp_firstfreeblock) = block_ptr;
-	mp_firstfreeblock = block_ptr;
+	SET_SUCC(block_ptr, NULL);
+	SET_PREV(block_ptr, NULL);
 }
 
-static void allocate_block(void * block_ptr)
+/*
+ * size_class - Class of a block of size bytes (a multiple of DSIZE)
+ */
+static unsigned int size_class(size_t size)
 {
-	m_freecount -= 1;
+	if (size <= SMALL_MAX)
+		return class_of_small[size / DSIZE];
+	return CLASS_OF_LARGE(size);
+}
 
-	if((m_freecount == 0)){ //already lowered free list // as in if only one free block.
-		PREV(block_ptr) = NULL;
-		SUCC(block_ptr) = NULL;
-		mp_firstfreeblock = NULL;
-		return;
+/*
+ * next_class - The first class from c on that has free blocks, or
+ *              NCLASSES if there is none
+ */
+static unsigned int next_class(unsigned int c)
+{
+	unsigned int w = c / 32, bits;
+
+	if (c >= NCLASSES)
+		return NCLASSES;
+	bits = m_heap->root->nonempty[w] & (~0u << (c % 32));
+	while (bits == 0)
+	{
+		if (++w == CLASSWORDS)
+			return NCLASSES;
+		bits = m_heap->root->nonempty[w];
 	}
-	if(m_freecount == -1){
-		printf("SHOULD NOT HAPPEN:: ERROR:: ERROR \n");
-		m_freecount = 0;
-		return;
+	return w * 32 + __builtin_ctz(bits);
+}
+
+/*
+ * remote_free_push - Free a block on behalf of a thread that does not
+ *                    own the heap: chain it onto the remote free queue
+ *                    through its first payload word, without the lock.
+ */
+static void remote_free_push(void *block_ptr)
+{
+	unsigned int off = PTR2OFF(block_ptr);
+	unsigned int head = __atomic_load_n(&m_heap->root->remote_free, __ATOMIC_RELAXED);
+
+	do {
+		PUT(block_ptr, head);
+	} while (!__atomic_compare_exchange_n(&m_heap->root->remote_free, &head, off, 1,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * remote_free_drain - Take the whole remote free queue in one exchange
+ *                     and free its blocks. Called with the lock held.
+ *                     Returns the number of blocks freed.
+ */
+static int remote_free_drain(void)
+{
+	unsigned int off = __atomic_exchange_n(&m_heap->root->remote_free, 0, __ATOMIC_ACQUIRE);
+	char *block_ptr;
+	int count = 0;
+
+	while (off != 0)
+	{
+		block_ptr = m_heap->base + off;
+		off = GET(block_ptr);
+		free_unlocked(block_ptr);
+		count++;
+	}
+	return count;
+}
+
+/*
+ * percpu_init - Carve the per-CPU caches out of the heap itself, so
+ *               that they are bounded by the number of CPUs and shared
+ *               along with the heap. Called with the lock held.
+ */
+static int percpu_init(void)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	mm_pcpu_t *pcpu;
+
+	m_heap->root->ncpus = (ncpus > 0) ? ncpus : 1;
+	pcpu = malloc_unlocked(m_heap->root->ncpus * sizeof(mm_pcpu_t));
+	if (pcpu == NULL)
+		return -1;
+	memset(pcpu, 0, m_heap->root->ncpus * sizeof(mm_pcpu_t));
+	m_heap->root->percpu = PTR2OFF(pcpu);
+	return 0;
+}
+
+/*
+ * percpu_claim - Claim the cache of the CPU this thread runs on, or
+ *                return NULL if another thread has it. The CPU number
+ *                comes from the rseq area glibc registers for each
+ *                thread, or from sched_getcpu without it. The caller
+ *                gives the cache back by clearing busy.
+ */
+static mm_pcpu_t *percpu_claim(void)
+{
+	mm_pcpu_t *pcpu;
+	int cpu = -1;
+
+#ifdef HAVE_RSEQ
+	if (__rseq_size > 0)
+		cpu = (int)((struct rseq *)((char *)__builtin_thread_pointer() +
+		                            __rseq_offset))->cpu_id;
+#endif
+	if (cpu < 0 && (cpu = sched_getcpu()) < 0)
+		cpu = 0;
+
+	pcpu = (mm_pcpu_t *)(m_heap->base + m_heap->root->percpu) + cpu % m_heap->root->ncpus;
+	if (__atomic_exchange_n(&pcpu->busy, 1, __ATOMIC_ACQUIRE) != 0)
+		return NULL;
+	return pcpu;
+}
+
+/*
+ * percpu_take - Take a block for a small request of size bytes from
+ *               the cache of the CPU we are on, if the heap has per-CPU
+ *               caches and the last cached block of its class starts on
+ *               an align boundary. Returns NULL otherwise.
+ */
+static void *percpu_take(size_t size, size_t align)
+{
+	mm_pcpu_t *pcpu;
+	size_t asize;
+	unsigned int *count;
+	char *block_ptr = NULL;
+
+	if (!(m_heap->root->flags & MM_PERCPU) || size > PCPU_MAXSIZE - OVERHEAD || size == 0)
+		return NULL;
+	asize = (size <= DSIZE) ? DSIZE + OVERHEAD : ALIGN(size + OVERHEAD);
+	if ((pcpu = percpu_claim()) == NULL)
+		return NULL;
+	count = &pcpu->count[PCPU_CLASS(asize)];
+	if (*count > 0)
+	{
+		block_ptr = m_heap->base + pcpu->slot[PCPU_CLASS(asize)][*count - 1];
+		if (((size_t)block_ptr & (align - 1)) == 0)
+			--*count;
+		else
+			block_ptr = NULL;
+	}
+	__atomic_store_n(&pcpu->busy, 0, __ATOMIC_RELEASE);
+	return block_ptr;
+}
+
+/*
+ * epoch_rec - Return this thread's epoch record, claiming a free one
+ *             on first use, or NULL if all of them are taken
+ */
+static mm_epoch_rec_t *epoch_rec(void)
+{
+	unsigned int expected;
+	int i;
+
+	if (m_epoch_rec != NULL)
+		return m_epoch_rec;
+
+	pthread_once(&m_epoch_once, epoch_key_init);
+	for (i = 0; i < EPOCH_THREADS; i++)
+	{
+		expected = EPOCH_FREE;
+		if (__atomic_compare_exchange_n(&m_epoch_recs[i].owner, &expected, EPOCH_USED, 0,
+		                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			m_epoch_rec = &m_epoch_recs[i];
+			m_epoch_rec->heap = NULL;
+			pthread_setspecific(m_epoch_key, m_epoch_rec);
+			return m_epoch_rec;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * epoch_key_init - Create the key whose destructor releases the epoch
+ *                  record of an exiting thread
+ */
+static void epoch_key_init(void)
+{
+	pthread_key_create(&m_epoch_key, epoch_thread_exit);
+}
+
+/*
+ * epoch_thread_exit - Release the record of an exiting thread. If it
+ *                     still has blocks in limbo, it is left orphaned
+ *                     for epoch_try_advance to drain.
+ */
+static void epoch_thread_exit(void *arg)
+{
+	mm_epoch_rec_t *rec = (mm_epoch_rec_t *)arg;
+
+	__atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+	if (rec->heap == NULL || rec->heap->gen != rec->heapgen ||
+	    (rec->limbo[0] == NULL && rec->limbo[1] == NULL && rec->limbo[2] == NULL))
+	{
+		rec->limbo[0] = rec->limbo[1] = rec->limbo[2] = NULL;
+		__atomic_store_n(&rec->owner, EPOCH_FREE, __ATOMIC_RELEASE);
+	}
+	else
+		__atomic_store_n(&rec->owner, EPOCH_ORPHANED, __ATOMIC_RELEASE);
+	m_epoch_rec = NULL;
+	m_epoch_depth = 0;
+}
+
+/*
+ * epoch_try_advance - Move the global epoch on if every thread in a
+ *                     read section has seen the current one, and drain
+ *                     orphaned records. Returns 1 if it advanced.
+ */
+static int epoch_try_advance(void)
+{
+	unsigned long epoch = __atomic_load_n(&m_epoch, __ATOMIC_SEQ_CST);
+	unsigned long active;
+	unsigned int expected;
+	mm_epoch_rec_t *rec;
+	int i;
+
+	for (i = 0; i < EPOCH_THREADS; i++)
+	{
+		rec = &m_epoch_recs[i];
+		if (__atomic_load_n(&rec->owner, __ATOMIC_ACQUIRE) == EPOCH_FREE)
+			continue;
+		active = __atomic_load_n(&rec->active, __ATOMIC_SEQ_CST);
+		if ((active & 1) && (active >> 1) != epoch)
+			return 0;
+	}
+	if (!__atomic_compare_exchange_n(&m_epoch, &epoch, epoch + 1, 0,
+	                                 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return 0;
+
+	for (i = 0; i < EPOCH_THREADS; i++)
+	{
+		rec = &m_epoch_recs[i];
+		expected = EPOCH_ORPHANED;
+		if (__atomic_compare_exchange_n(&rec->owner, &expected, EPOCH_DRAINING, 0,
+		                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			epoch_reclaim(rec);
+			__atomic_store_n(&rec->owner, (rec->limbo[0] == NULL && rec->limbo[1] == NULL &&
+			                               rec->limbo[2] == NULL) ? EPOCH_FREE : EPOCH_ORPHANED,
+			                 __ATOMIC_RELEASE);
+		}
+	}
+	return 1;
+}
+
+/*
+ * epoch_chunk - Return the limbo chunk of the current epoch that the
+ *               next deferred block goes into, or NULL if there is no
+ *               room for a new chunk
+ */
+static mm_limbo_t *epoch_chunk(mm_epoch_rec_t *rec)
+{
+	unsigned long epoch;
+	mm_limbo_t *chunk;
+	int b;
+
+	if (rec->heap != m_heap || rec->heapgen != m_heap->gen)
+	{
+		/* Blocks of another heap still in limbo are freed once safe */
+		if (rec->heap != NULL && rec->heap->gen == rec->heapgen &&
+		    (rec->limbo[0] != NULL || rec->limbo[1] != NULL || rec->limbo[2] != NULL))
+		{
+			epoch_synchronize();
+			epoch_reclaim(rec);
+		}
+		rec->limbo[0] = rec->limbo[1] = rec->limbo[2] = NULL;
+		rec->heap = m_heap;
+		rec->heapgen = m_heap->gen;
+	}
+
+	/* A list that still waits on an older epoch is at least 3 behind */
+	epoch = __atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE);
+	b = epoch % 3;
+	if (rec->limbo_epoch[b] != epoch)
+	{
+		epoch_free_chain(rec->limbo[b]);
+		rec->limbo[b] = NULL;
+		rec->limbo_epoch[b] = epoch;
+	}
+
+	if ((chunk = rec->limbo[b]) == NULL || chunk->count == EPOCH_BATCH)
+	{
+		if ((chunk = mm_ctx_malloc(m_heap->mem, sizeof(mm_limbo_t))) == NULL)
+			return NULL;
+		chunk->next = rec->limbo[b];
+		chunk->count = 0;
+		rec->limbo[b] = chunk;
 	}
-	void* pp = PREV(block_ptr);
-	void* np = SUCC(block_ptr);
+	return chunk;
+}
 
-	if(np == NULL){
-		SUCC(pp) = NULL;
+/*
+ * epoch_reclaim - Free the limbo lists of rec whose grace period is
+ *                 over. The blocks go back to the heap of rec, or are
+ *                 dropped if that heap has been replaced since.
+ */
+static void epoch_reclaim(mm_epoch_rec_t *rec)
+{
+	unsigned long epoch = __atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE);
+	mm_heap_t *heap = m_heap;
+	int b;
 
-		SUCC(block_ptr) = NULL;
-		PREV(block_ptr) = NULL;
+	if (rec->heap == NULL || rec->heap->gen != rec->heapgen)
+	{
+		rec->limbo[0] = rec->limbo[1] = rec->limbo[2] = NULL;
 		return;
 	}
-	else if(pp == NULL){
-		mp_firstfreeblock = SUCC(block_ptr);
-		PREV(mp_firstfreeblock) = NULL;
-		PREV(block_ptr) = NULL;
-		SUCC(block_ptr) = NULL;
+	m_heap = rec->heap;
+	for (b = 0; b < 3; b++)
+	{
+		if (rec->limbo[b] != NULL && rec->limbo_epoch[b] + 2 <= epoch)
+		{
+			epoch_free_chain(rec->limbo[b]);
+			rec->limbo[b] = NULL;
+		}
+	}
+	m_heap = heap;
+}
+
+/*
+ * epoch_free_chain - Free a limbo list and its blocks, a chunk at a
+ *                    time through mm_free_batch
+ */
+static void epoch_free_chain(mm_limbo_t *chunk)
+{
+	mm_limbo_t *next;
+
+	while (chunk != NULL)
+	{
+		next = chunk->next;
+		mm_ctx_free_batch(m_heap->mem, chunk->ptrs, chunk->count);
+		mm_ctx_free(m_heap->mem, chunk);
+		chunk = next;
+	}
+}
+
+/*
+ * epoch_synchronize - Wait until every read section open on entry has
+ *                     been left, by waiting for two epoch advances
+ */
+static void epoch_synchronize(void)
+{
+	unsigned long epoch = __atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE);
+
+	while (__atomic_load_n(&m_epoch, __ATOMIC_ACQUIRE) < epoch + 2)
+	{
+		if (!epoch_try_advance())
+			sched_yield();
+	}
+}
+
+/*
+ * now_ms - A cheap millisecond clock for the free time of blocks
+ */
+static unsigned int now_ms(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (unsigned int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * purger - Background thread of mm_set_decay: purge every half decay
+ *          time until purger_stop
+ */
+static void *purger(void *arg)
+{
+	mm_heap_t *heap = (mm_heap_t *)arg;
+	unsigned int ms = heap->root->decay_ms / 2 + 1;
+	struct timespec ts;
+
+	m_heap = heap;
+	pthread_mutex_lock(&heap->purger_lock);
+	while (!heap->purger_stop)
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += ms / 1000;
+		ts.tv_nsec += (ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		if (pthread_cond_timedwait(&heap->purger_cond, &heap->purger_lock, &ts) == ETIMEDOUT &&
+		    !heap->purger_stop)
+		{
+			pthread_mutex_unlock(&heap->purger_lock);
+			mm_ctx_purge(heap->mem);
+			pthread_mutex_lock(&heap->purger_lock);
+		}
+	}
+	pthread_mutex_unlock(&heap->purger_lock);
+	return NULL;
+}
+
+/*
+ * purger_stop - Stop the background purger of the current heap, if
+ *               there is one
+ */
+static void purger_stop(void)
+{
+	if (!m_heap->purger_running)
 		return;
+	pthread_mutex_lock(&m_heap->purger_lock);
+	m_heap->purger_stop = 1;
+	pthread_cond_signal(&m_heap->purger_cond);
+	pthread_mutex_unlock(&m_heap->purger_lock);
+	pthread_join(m_heap->purger, NULL);
+	m_heap->purger_running = 0;
+}
+
+/*
+ * heap_lock - Take the lock of a shared heap. If its previous holder
+ *             died, the lock is recovered and the heap used as it is.
+ */
+static void heap_lock(void)
+{
+	if (pthread_mutex_lock(&m_heap->root->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&m_heap->root->lock);
+}
+
+/*
+ * heap_claim - Make the heap of ctx the current one, taking a free slot
+ *              of m_heaps for it if it has none yet. Returns NULL if
+ *              every slot is in use.
+ */
+static mm_heap_t *heap_claim(mem_ctx_t *ctx)
+{
+	void **client = mem_ctx_client(ctx);
+	int i;
+
+	if (*client == NULL)
+	{
+		pthread_mutex_lock(&m_heaps_lock);
+		for (i = 0; i < MM_HEAPS && m_heaps[i].mem != NULL; i++)
+			;
+		if (i < MM_HEAPS)
+		{
+			m_heaps[i].mem = ctx;
+			m_heaps[i].root = NULL;
+			m_heaps[i].purger_running = 0;
+			pthread_mutex_init(&m_heaps[i].purger_lock, NULL);
+			pthread_cond_init(&m_heaps[i].purger_cond, NULL);
+			*client = &m_heaps[i];
+		}
+		pthread_mutex_unlock(&m_heaps_lock);
 	}
+	return m_heap = *client;
+}
+
+/*
+ * heap_use - Make the heap of ctx the current one
+ */
+static void heap_use(mem_ctx_t *ctx)
+{
+	if (m_heap == NULL || m_heap->mem != ctx)
+		m_heap = *mem_ctx_client(ctx);
+}
 
-	SUCC(pp) = np;
-	PREV(np) = pp;
+/*
+ * prewarm - Carve the blocks named by the size profile (PROFILE_SIZES
+ *           and PROFILE_COUNTS) out of one extension of the heap, so
+ *           that the first requests of those sizes find a block of
+ *           their own right away. Like the per-CPU caches, the blocks
+ *           stay marked allocated, chained by class through their
+ *           first payload word, so coalescing leaves them alone until
+ *           warm_take hands them out.
+ */
+static int prewarm(void)
+{
+#if defined(PROFILE_NSIZES) && PROFILE_NSIZES > 0
+	static const unsigned int sizes[PROFILE_NSIZES] = PROFILE_SIZES;
+	static const unsigned int counts[PROFILE_NSIZES] = PROFILE_COUNTS;
+	size_t total = 0, rest;
+	char *block_ptr;
+	unsigned int c, n;
+	int i;
+
+	for (i = 0; i < PROFILE_NSIZES; i++)
+		total += (size_t)sizes[i] * counts[i];
+	if (total == 0)
+		return 0;
+	if ((block_ptr = extend_heap(total/WSIZE)) == NULL)
+		return -1;
+
+	/* The extension may have merged with a free block before it */
+	rest = GET_SIZE(HDRP(block_ptr));
+	allocate_block(block_ptr);
+	for (i = 0; i < PROFILE_NSIZES; i++)
+	{
+		c = size_class(sizes[i]);
+		for (n = 0; n < counts[i]; n++)
+		{
+			PUT(HDRP(block_ptr), PACK(sizes[i], 1));
+			PUT(FTRP(block_ptr), PACK(sizes[i], 1));
+			PUT(block_ptr, m_heap->root->warm[c]);
+			m_heap->root->warm[c] = PTR2OFF(block_ptr);
+			m_heap->root->warmcount++;
+			rest -= sizes[i];
+			block_ptr = NEXT_BLKP(block_ptr);
+		}
+	}
+	if (rest > 0)
+	{
+		PUT(HDRP(block_ptr), PACK(rest, 0));
+		PUT(FTRP(block_ptr), PACK(rest, 0));
+		free_block(block_ptr);
+	}
+#endif
+	return 0;
+}
 
+/*
+ * warm_take - Hand out the first prewarmed block of the class of asize
+ *             if it is big enough, or return NULL
+ */
+static void *warm_take(size_t asize)
+{
+	unsigned int c = size_class(asize);
+	char *block_ptr = OFF2PTR(m_heap->root->warm[c]);
 
-	SUCC(block_ptr) = NULL;
-	PREV(block_ptr) = NULL;
+	if (block_ptr == NULL || GET_SIZE(HDRP(block_ptr)) < asize)
+		return NULL;
+	m_heap->root->warm[c] = GET(block_ptr);
+	m_heap->root->warmcount--;
+	return block_ptr;
 }
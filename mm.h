@@ -1,9 +1,63 @@
 #include <stdio.h>
 
 extern int mm_init (void);
+extern int mm_init_flags (int flags);
+extern int mm_attach (void);
+extern int mm_reset (void);
+extern int mm_snapshot (FILE *fp);
+extern int mm_restore (FILE *fp);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_free_batch (void **ptrs, int n);
+extern void *mm_memalign (size_t align, size_t size);
+extern void mm_free_sized (void *ptr, size_t size);
+extern void mm_free_deferred (void *ptr);
+extern int mm_epoch_enter (void);
+extern void mm_epoch_exit (void);
+extern int mm_set_decay (unsigned int ms);
+extern size_t mm_purge (void);
+extern void mm_lock (void);
+extern void mm_unlock (void);
+extern unsigned int mm_size_class (size_t size);
+extern size_t mm_usable_size (void *ptr);
+
+/* 
+ * mm_free_sized takes the size the block was asked for. Only on an
+ * MM_PERCPU heap, and for sizes of up to 248 bytes, does that let it
+ * cache the block without reading its header; otherwise it is mm_free.
+ */
+
+/* 
+ * The same on the heap in a given memlib context (see memlib.h), so
+ * that several heaps can be used at once; the functions above work on
+ * the default context. A context holds at most one heap.
+ */
+struct mem_ctx;
+extern int mm_ctx_init_flags (struct mem_ctx *ctx, int flags);
+extern int mm_ctx_attach (struct mem_ctx *ctx);
+extern void mm_ctx_detach (struct mem_ctx *ctx);
+extern int mm_ctx_reset (struct mem_ctx *ctx);
+extern int mm_ctx_snapshot (struct mem_ctx *ctx, FILE *fp);
+extern int mm_ctx_restore (struct mem_ctx *ctx, FILE *fp);
+extern void *mm_ctx_malloc (struct mem_ctx *ctx, size_t size);
+extern void mm_ctx_free (struct mem_ctx *ctx, void *ptr);
+extern void *mm_ctx_realloc (struct mem_ctx *ctx, void *ptr, size_t size);
+extern void mm_ctx_free_batch (struct mem_ctx *ctx, void **ptrs, int n);
+extern void *mm_ctx_memalign (struct mem_ctx *ctx, size_t align, size_t size);
+extern void mm_ctx_free_sized (struct mem_ctx *ctx, void *ptr, size_t size);
+extern void mm_ctx_free_deferred (struct mem_ctx *ctx, void *ptr);
+extern int mm_ctx_set_decay (struct mem_ctx *ctx, unsigned int ms);
+extern size_t mm_ctx_purge (struct mem_ctx *ctx);
+extern void mm_ctx_lock (struct mem_ctx *ctx);
+extern void mm_ctx_unlock (struct mem_ctx *ctx);
+extern void mm_ctx_checkheap (struct mem_ctx *ctx, int verbose);
+
+/* Flags for mm_init_flags */
+#define MM_THREADSAFE   0x1  /* requests may come from several threads */
+#define MM_REMOTE_FREE  0x2  /* queue frees from non-owner threads */
+#define MM_PERCPU       0x4  /* cache small blocks per CPU */
+#define MM_LINEALIGN    0x8  /* give each thread cache lines of its own */
 
 
 /* 
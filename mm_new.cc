@@ -0,0 +1,189 @@
+/*
+ * mm_new.cc - Global operator new and delete on the mm allocator
+ *
+ * Linking a C++ program against libmmnew.a (see the Makefile) replaces
+ * every form of the global operator new and delete, plain, array,
+ * nothrow, sized and aligned, with ones that use the mm heap in the
+ * default memlib context. The heap is set up on the first allocation
+ * with MM_THREADSAFE and MM_PERCPU, so that sized deletes of small
+ * objects go straight to the per-CPU caches. Its cap is 1 GB unless
+ * MEM_MAX_HEAP sets another. mm blocks are only 8-byte aligned, so every
+ * block is allocated with mm_memalign to at least
+ * __STDCPP_DEFAULT_NEW_ALIGNMENT__, which plain new promises.
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <pthread.h>
+
+extern "C" {
+#include "mm.h"
+#include "memlib.h"
+}
+
+#define NEW_FLAGS    (MM_THREADSAFE | MM_PERCPU)  /* flags of the heap */
+#define NEW_MAX_HEAP (1UL<<30)  /* heap cap unless MEM_MAX_HEAP is set */
+
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+static int heap_ok;               /* set once the heap is up */
+
+static void heap_init(void)
+{
+    if (std::getenv("MEM_MAX_HEAP") == NULL)
+        mem_set_max_heap(NEW_MAX_HEAP);
+    mem_init();
+    heap_ok = (mm_init_flags(NEW_FLAGS) == 0);
+}
+
+/*
+ * new_block - Allocate size bytes aligned to align, calling the new
+ *     handler until it succeeds, or return NULL if there is no handler
+ */
+static void *new_block(std::size_t size, std::size_t align)
+{
+    void *p;
+    std::new_handler handler;
+
+    pthread_once(&heap_once, heap_init);
+    if (!heap_ok)
+        return NULL;
+    if (size == 0)
+        size = 1;
+    for (;;) {
+        p = mm_memalign(align > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ?
+                        align : __STDCPP_DEFAULT_NEW_ALIGNMENT__, size);
+        if (p != NULL || (handler = std::get_new_handler()) == NULL)
+            return p;
+        handler();
+    }
+}
+
+static void *new_or_throw(std::size_t size, std::size_t align)
+{
+    void *p = new_block(size, align);
+
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+static void *new_nothrow(std::size_t size, std::size_t align) noexcept
+{
+    try {
+        return new_block(size, align);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+static void delete_block(void *p) noexcept
+{
+    if (p != NULL)
+        mm_free(p);
+}
+
+static void delete_sized(void *p, std::size_t size) noexcept
+{
+    if (p != NULL)
+        mm_free_sized(p, size ? size : 1);
+}
+
+void *operator new(std::size_t size)
+{
+    return new_or_throw(size, 0);
+}
+
+void *operator new[](std::size_t size)
+{
+    return new_or_throw(size, 0);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return new_nothrow(size, 0);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return new_nothrow(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t align)
+{
+    return new_or_throw(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align)
+{
+    return new_or_throw(size, static_cast<std::size_t>(align));
+}
+
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return new_nothrow(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return new_nothrow(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void *p) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete(void *p, std::size_t size) noexcept
+{
+    delete_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept
+{
+    delete_sized(p, size);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    delete_block(p);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t) noexcept
+{
+    delete_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t) noexcept
+{
+    delete_sized(p, size);
+}
@@ -0,0 +1,116 @@
+/*
+ * mm_policy.cc - the mm.h functions on one mm::Allocator combination
+ *
+ * The combination is chosen with -D at compile time, each macro naming
+ * a policy of mm_policy.hpp (the Makefile builds an mdriver-* for a few
+ * of them):
+ *
+ *   MM_HEADER    mm::Tags4 or mm::Tags8
+ *   MM_INDEX     mm::SegregatedLists or mm::SingleList
+ *   MM_ORDER     mm::Lifo or mm::AddressOrder
+ *   MM_FIT       mm::FirstFit or mm::BestFit
+ *   MM_COALESCE  mm::ImmediateCoalesce or mm::DeferredCoalesce
+ *
+ * The defaults are mm.c's layout and placement, so "mdriver-policy"
+ * against "mdriver" measures what the templates cost.
+ *
+ * The allocator has no MM_* flags: mm_init_flags fails for any but 0,
+ * the locks do nothing, and there is nothing to decay or purge. Epochs
+ * and mm_free_deferred are left out, so programs that use them do not
+ * link against this file.
+ */
+#include "mm_policy.hpp"
+
+extern "C" {
+#include "mm.h"
+}
+
+#ifndef MM_HEADER
+#define MM_HEADER mm::Tags4
+#endif
+#ifndef MM_INDEX
+#define MM_INDEX mm::SegregatedLists
+#endif
+#ifndef MM_ORDER
+#define MM_ORDER mm::Lifo
+#endif
+#ifndef MM_FIT
+#define MM_FIT mm::FirstFit
+#endif
+#ifndef MM_COALESCE
+#define MM_COALESCE mm::ImmediateCoalesce
+#endif
+
+using allocator = mm::Allocator<MM_HEADER, MM_INDEX<MM_ORDER>, MM_FIT, MM_COALESCE>;
+
+team_t team = {
+    const_cast<char *>("Fighting_Mongoose"),
+    const_cast<char *>("juliusg13"), const_cast<char *>("2801922799"),
+    const_cast<char *>(""), const_cast<char *>(""),
+    const_cast<char *>(""), const_cast<char *>("")
+};
+
+extern "C" {
+
+int mm_ctx_init_flags(mem_ctx_t *ctx, int flags)
+{
+    return flags == 0 ? allocator::init(ctx) : -1;
+}
+
+int mm_ctx_attach(mem_ctx_t *ctx) { return allocator::attach(ctx); }
+void mm_ctx_detach(mem_ctx_t *) {}
+int mm_ctx_reset(mem_ctx_t *ctx) { return allocator::reset(ctx); }
+int mm_ctx_snapshot(mem_ctx_t *ctx, FILE *fp) { return allocator::snapshot(ctx, fp); }
+int mm_ctx_restore(mem_ctx_t *ctx, FILE *fp) { return allocator::restore(ctx, fp); }
+void *mm_ctx_malloc(mem_ctx_t *ctx, size_t size) { return allocator::malloc(ctx, size); }
+void mm_ctx_free(mem_ctx_t *ctx, void *ptr) { allocator::free(ctx, ptr); }
+
+void *mm_ctx_realloc(mem_ctx_t *ctx, void *ptr, size_t size)
+{
+    return allocator::realloc(ctx, ptr, size);
+}
+
+void mm_ctx_free_batch(mem_ctx_t *ctx, void **ptrs, int n)
+{
+    for (int i = 0; i < n; i++)
+        allocator::free(ctx, ptrs[i]);
+}
+
+void *mm_ctx_memalign(mem_ctx_t *ctx, size_t align, size_t size)
+{
+    return allocator::memalign(ctx, align, size);
+}
+
+void mm_ctx_free_sized(mem_ctx_t *ctx, void *ptr, size_t) { allocator::free(ctx, ptr); }
+int mm_ctx_set_decay(mem_ctx_t *, unsigned int ms) { return ms == 0 ? 0 : -1; }
+size_t mm_ctx_purge(mem_ctx_t *) { return 0; }
+void mm_ctx_lock(mem_ctx_t *) {}
+void mm_ctx_unlock(mem_ctx_t *) {}
+void mm_ctx_checkheap(mem_ctx_t *ctx, int verbose) { allocator::checkheap(ctx, verbose); }
+
+int mm_init(void) { return mm_ctx_init_flags(mem_default_ctx(), 0); }
+int mm_init_flags(int flags) { return mm_ctx_init_flags(mem_default_ctx(), flags); }
+int mm_attach(void) { return mm_ctx_attach(mem_default_ctx()); }
+int mm_reset(void) { return mm_ctx_reset(mem_default_ctx()); }
+int mm_snapshot(FILE *fp) { return mm_ctx_snapshot(mem_default_ctx(), fp); }
+int mm_restore(FILE *fp) { return mm_ctx_restore(mem_default_ctx(), fp); }
+void *mm_malloc(size_t size) { return mm_ctx_malloc(mem_default_ctx(), size); }
+void mm_free(void *ptr) { mm_ctx_free(mem_default_ctx(), ptr); }
+void *mm_realloc(void *ptr, size_t size) { return mm_ctx_realloc(mem_default_ctx(), ptr, size); }
+void mm_free_batch(void **ptrs, int n) { mm_ctx_free_batch(mem_default_ctx(), ptrs, n); }
+
+void *mm_memalign(size_t align, size_t size)
+{
+    return mm_ctx_memalign(mem_default_ctx(), align, size);
+}
+
+void mm_free_sized(void *ptr, size_t size) { mm_ctx_free_sized(mem_default_ctx(), ptr, size); }
+int mm_set_decay(unsigned int ms) { return mm_ctx_set_decay(mem_default_ctx(), ms); }
+size_t mm_purge(void) { return mm_ctx_purge(mem_default_ctx()); }
+void mm_lock(void) {}
+void mm_unlock(void) {}
+void mm_checkheap(int verbose) { mm_ctx_checkheap(mem_default_ctx(), verbose); }
+unsigned int mm_size_class(size_t size) { return allocator::size_class(size); }
+size_t mm_usable_size(void *ptr) { return allocator::usable_size(ptr); }
+
+}
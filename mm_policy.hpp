@@ -0,0 +1,745 @@
+/*
+ * mm_policy.hpp - the mm allocator as a combination of policies
+ *
+ * mm::Allocator<Header, Index, Fit, Coalesce> is a boundary tag
+ * allocator whose block layout and placement are chosen at compile
+ * time, so that trying another policy takes a template argument rather
+ * than a copy of mm.c:
+ *
+ *   Header    Tags4 (4-byte tags, 8-byte alignment, as in mm.c) or
+ *             Tags8 (8-byte tags, 16-byte alignment)
+ *   Index     SegregatedLists<Order> (mm.c's size classes) or
+ *             SingleList<Order>, with Order Lifo or AddressOrder
+ *   Fit       FirstFit or BestFit, within the first class with a fit
+ *   Coalesce  ImmediateCoalesce (on every free, as in mm.c) or
+ *             DeferredCoalesce (only when a search finds no fit)
+ *
+ * Block sizes, the minimum block, the size of the roots and the magic
+ * number are all constants of the combination. Like mm.c, the roots sit
+ * at the start of a memlib region and free list links are 32-bit heap
+ * offsets, so a heap can be snapshot and restored, but every
+ * combination has a magic number of its own and will not adopt another
+ * one's heap.
+ *
+ * The allocator is single-threaded and has none of mm.c's MM_* flags,
+ * size profiles, decay or epochs; mm_policy.cc puts the mm.h functions
+ * that make sense without them on top of one combination.
+ */
+#ifndef MM_POLICY_HPP
+#define MM_POLICY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <array>
+
+extern "C" {
+#include "memlib.h"
+}
+
+namespace mm {
+
+namespace detail {
+constexpr std::size_t round_up(std::size_t n, std::size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+}
+
+/* Header policies: the width of the boundary tags and the alignment */
+struct Tags4 {
+    using word = std::uint32_t;
+    static constexpr std::size_t align = 8;
+    static constexpr unsigned id = 0;
+};
+
+struct Tags8 {
+    using word = std::uint64_t;
+    static constexpr std::size_t align = 16;
+    static constexpr unsigned id = 1;
+};
+
+/*
+ * Heap - the layout of the blocks of one heap. Each block has a header
+ * and a footer word holding its size and allocated bit; a free block
+ * keeps the offsets of its predecessor and successor on its free list
+ * in the first two 32-bit words of its payload.
+ */
+template <class Header>
+struct Heap {
+    using word = typename Header::word;
+
+    static constexpr std::size_t wsize = sizeof(word);
+    static constexpr std::size_t align = Header::align;
+    static constexpr std::size_t overhead = 2 * wsize;
+    static constexpr std::size_t min_block =
+        detail::round_up(overhead + 2 * sizeof(std::uint32_t), align);
+
+    static_assert((align & (align - 1)) == 0 && align >= 8, "sizes need 3 free low bits");
+    static_assert(wsize < align, "the prologue pads the first header to align - wsize");
+
+    mem_ctx_t *ctx;  /* memlib context of the heap */
+    char *base;      /* start of its region, where the roots are */
+
+    static word &hdr(char *bp) { return *reinterpret_cast<word *>(bp - wsize); }
+    static word &ftr(char *bp) { return *reinterpret_cast<word *>(bp + size(bp) - overhead); }
+    static std::size_t size(char *bp) { return hdr(bp) & ~word(7); }
+    static bool alloc(char *bp) { return hdr(bp) & 1; }
+    static char *next(char *bp) { return bp + size(bp); }
+    static char *prev(char *bp)
+    {
+        return bp - (*reinterpret_cast<word *>(bp - overhead) & ~word(7));
+    }
+    static bool prev_alloc(char *bp) { return *reinterpret_cast<word *>(bp - overhead) & 1; }
+    static void set(char *bp, std::size_t size, bool alloc)
+    {
+        hdr(bp) = word(size | alloc);
+        ftr(bp) = word(size | alloc);
+    }
+
+    /* Free list links, 0 standing for none as the roots sit at offset 0 */
+    std::uint32_t off(char *p) const { return p == nullptr ? 0 : std::uint32_t(p - base); }
+    char *ptr(std::uint32_t o) const { return o == 0 ? nullptr : base + o; }
+    char *pred(char *bp) const { return ptr(reinterpret_cast<std::uint32_t *>(bp)[0]); }
+    char *succ(char *bp) const { return ptr(reinterpret_cast<std::uint32_t *>(bp)[1]); }
+    void set_pred(char *bp, char *p) const { reinterpret_cast<std::uint32_t *>(bp)[0] = off(p); }
+    void set_succ(char *bp, char *p) const { reinterpret_cast<std::uint32_t *>(bp)[1] = off(p); }
+};
+
+/* Order policies: where a freed block goes on its list */
+struct Lifo {
+    static constexpr unsigned id = 0;
+
+    template <class H>
+    static void insert(const H &h, std::uint32_t &head, char *bp)
+    {
+        char *first = h.ptr(head);
+
+        h.set_succ(bp, first);
+        h.set_pred(bp, nullptr);
+        if (first != nullptr)
+            h.set_pred(first, bp);
+        head = h.off(bp);
+    }
+};
+
+struct AddressOrder {
+    static constexpr unsigned id = 1;
+
+    template <class H>
+    static void insert(const H &h, std::uint32_t &head, char *bp)
+    {
+        char *prev = nullptr, *next = h.ptr(head);
+
+        while (next != nullptr && next < bp) {
+            prev = next;
+            next = h.succ(next);
+        }
+        h.set_succ(bp, next);
+        h.set_pred(bp, prev);
+        if (next != nullptr)
+            h.set_pred(next, bp);
+        if (prev != nullptr)
+            h.set_succ(prev, bp);
+        else
+            head = h.off(bp);
+    }
+};
+
+namespace detail {
+/* The size classes of SegregatedLists, as in mm.c */
+constexpr std::size_t quantum = 8;
+
+constexpr unsigned class_of_large(std::size_t s)
+{
+    unsigned lg = 31 - __builtin_clz(unsigned(s) - 1);
+
+    return 15 + (lg - 7) * 4 + (((unsigned(s) - 1) >> (lg - 2)) & 3);
+}
+
+constexpr unsigned class_of(std::size_t s)
+{
+    return s < 2 * quantum ? 0 : s <= 128 ? unsigned(s / quantum - 2) : class_of_large(s);
+}
+
+/* Smallest block size of class c */
+constexpr std::size_t class_min(unsigned c)
+{
+    return c < 15 ? (c + 2) * quantum :
+        (std::size_t(128) << ((c - 15) / 4)) +
+        ((c - 15) % 4) * (std::size_t(32) << ((c - 15) / 4)) + quantum;
+}
+
+template <std::size_t N>
+constexpr std::array<unsigned char, N> class_table()
+{
+    std::array<unsigned char, N> t{};
+
+    for (std::size_t i = 0; i < N; i++)
+        t[i] = (unsigned char)class_of(i * quantum);
+    return t;
+}
+
+static_assert(class_min(15) == 136 && class_of(136) == 15 && class_of(128) == 14,
+              "class_min is the first size of each class");
+
+/* Take bp off the list whose head is head; true if that emptied it */
+template <class H>
+bool unlink(const H &h, std::uint32_t &head, char *bp)
+{
+    char *pp = h.pred(bp), *np = h.succ(bp);
+
+    if (np != nullptr)
+        h.set_pred(np, pp);
+    if (pp != nullptr) {
+        h.set_succ(pp, np);
+        return false;
+    }
+    head = h.off(np);
+    return np == nullptr;
+}
+}
+
+/* Fit policies: which block of one list a request takes */
+struct FirstFit {
+    static constexpr unsigned id = 0;
+
+    template <class H>
+    static char *scan(const H &h, char *bp, std::size_t asize)
+    {
+        for (; bp != nullptr; bp = h.succ(bp))
+            if (asize <= H::size(bp))
+                return bp;
+        return nullptr;
+    }
+};
+
+struct BestFit {
+    static constexpr unsigned id = 1;
+
+    /* stops early at an exact fit */
+    template <class H>
+    static char *scan(const H &h, char *bp, std::size_t asize)
+    {
+        char *best = nullptr;
+        std::size_t size, bestsize = 0;
+
+        for (; bp != nullptr; bp = h.succ(bp)) {
+            size = H::size(bp);
+            if (asize <= size && (best == nullptr || size < bestsize)) {
+                best = bp;
+                bestsize = size;
+                if (size == asize)
+                    break;
+            }
+        }
+        return best;
+    }
+};
+
+/* Index policies: the free lists and how a request picks one */
+template <class Order = Lifo>
+struct SingleList {
+    static constexpr unsigned id = 0 + Order::id;
+    static constexpr unsigned nlists = 1;
+
+    struct state {
+        std::uint32_t head;  /* offset of the first free block */
+        std::int32_t count;  /* number of free blocks */
+    };
+
+    static constexpr unsigned size_class(std::size_t) { return 0; }
+    static constexpr bool belongs(unsigned list, std::size_t) { return list == 0; }
+
+    template <class H>
+    static void insert(const H &h, state &s, char *bp)
+    {
+        Order::insert(h, s.head, bp);
+        s.count++;
+    }
+
+    template <class H>
+    static void remove(const H &h, state &s, char *bp)
+    {
+        detail::unlink(h, s.head, bp);
+        s.count--;
+    }
+
+    template <class Fit, class H>
+    static char *find(const H &h, state &s, std::size_t asize)
+    {
+        return Fit::scan(h, h.ptr(s.head), asize);
+    }
+
+    static std::uint32_t head(const state &s, unsigned) { return s.head; }
+    static int count(const state &s) { return s.count; }
+};
+
+/*
+ * SegregatedLists - mm.c's size classes: a class every 8 bytes up to
+ * 128, then four for each power of two. A bit set of the classes that
+ * have free blocks lets a search skip the empty ones. The classes of
+ * blocks of up to small_max bytes come from a table built at compile
+ * time.
+ */
+template <class Order = Lifo>
+struct SegregatedLists {
+    static constexpr unsigned id = 2 + Order::id;
+    static constexpr unsigned nlists = 115;  /* class of the largest 32-bit size, plus 1 */
+    static constexpr unsigned words = (nlists + 31) / 32;
+    static constexpr std::size_t quantum = detail::quantum;
+    static constexpr std::size_t small_max = 4096;
+
+    struct state {
+        std::uint32_t head[nlists];     /* offset of the head of each class */
+        std::uint32_t nonempty[words];  /* bit set of classes with free blocks */
+        std::int32_t count;             /* number of free blocks */
+    };
+
+    static constexpr auto class_of_small = detail::class_table<small_max / quantum + 1>();
+
+    static_assert(detail::class_of(0xfffffff8u) + 1 == nlists, "nlists covers every 32-bit size");
+
+    static unsigned size_class(std::size_t size)
+    {
+        return size <= small_max ? class_of_small[size / quantum] : detail::class_of_large(size);
+    }
+
+    static bool belongs(unsigned c, std::size_t size)
+    {
+        return size >= detail::class_min(c) && (c + 1 == nlists || size < detail::class_min(c + 1));
+    }
+
+    /* The first class from c on that has free blocks, or nlists */
+    static unsigned next_class(const state &s, unsigned c)
+    {
+        unsigned w = c / 32, bits;
+
+        if (c >= nlists)
+            return nlists;
+        bits = s.nonempty[w] & (~0u << (c % 32));
+        while (bits == 0) {
+            if (++w == words)
+                return nlists;
+            bits = s.nonempty[w];
+        }
+        return w * 32 + __builtin_ctz(bits);
+    }
+
+    template <class H>
+    static void insert(const H &h, state &s, char *bp)
+    {
+        unsigned c = size_class(H::size(bp));
+
+        Order::insert(h, s.head[c], bp);
+        s.nonempty[c / 32] |= 1u << (c % 32);
+        s.count++;
+    }
+
+    template <class H>
+    static void remove(const H &h, state &s, char *bp)
+    {
+        unsigned c = size_class(H::size(bp));
+
+        if (detail::unlink(h, s.head[c], bp))
+            s.nonempty[c / 32] &= ~(1u << (c % 32));
+        s.count--;
+    }
+
+    /* Only blocks in the class of asize can be too small */
+    template <class Fit, class H>
+    static char *find(const H &h, state &s, std::size_t asize)
+    {
+        char *bp;
+        unsigned c;
+
+        for (c = size_class(asize); (c = next_class(s, c)) < nlists; c++)
+            if ((bp = Fit::scan(h, h.ptr(s.head[c]), asize)) != nullptr)
+                return bp;
+        return nullptr;
+    }
+
+    static std::uint32_t head(const state &s, unsigned c) { return s.head[c]; }
+    static int count(const state &s) { return s.count; }
+};
+
+/*
+ * Coalesce policies, each with a state kept in the roots. freed() gets
+ * a block just marked free and returns the block to put on the free
+ * lists; missed() is called when a search finds no fit and returns true
+ * if it made larger free blocks.
+ */
+struct ImmediateCoalesce {
+    static constexpr unsigned id = 0;
+    static constexpr bool keeps_apart = true;  /* no two free blocks are adjacent */
+
+    struct state {};
+
+    template <class Index, class H>
+    static char *freed(const H &h, typename Index::state &s, state &, char *bp)
+    {
+        std::size_t size = H::size(bp);
+        char *np = H::next(bp);
+
+        if (!H::alloc(np)) {
+            Index::remove(h, s, np);
+            size += H::size(np);
+        }
+        if (!H::prev_alloc(bp)) {
+            bp = H::prev(bp);
+            Index::remove(h, s, bp);
+            size += H::size(bp);
+        }
+        H::set(bp, size, false);
+        return bp;
+    }
+
+    template <class Index, class H>
+    static bool missed(const H &, typename Index::state &, state &, char *)
+    {
+        return false;
+    }
+};
+
+struct DeferredCoalesce {
+    static constexpr unsigned id = 1;
+    static constexpr bool keeps_apart = false;
+
+    struct state {
+        std::uint32_t freed;  /* blocks freed since the last sweep */
+    };
+
+    template <class Index, class H>
+    static char *freed(const H &, typename Index::state &, state &cs, char *bp)
+    {
+        cs.freed++;
+        return bp;
+    }
+
+    /*
+     * One pass over the heap from first, merging each run of free
+     * blocks, unless nothing has been freed since the last one
+     */
+    template <class Index, class H>
+    static bool missed(const H &h, typename Index::state &s, state &cs, char *first)
+    {
+        bool merged = false;
+        std::size_t size;
+        char *bp, *np;
+
+        if (cs.freed == 0)
+            return false;
+        cs.freed = 0;
+        for (bp = first; H::size(bp) > 0; bp = H::next(bp)) {
+            if (H::alloc(bp) || H::alloc(np = H::next(bp)))
+                continue;
+            Index::remove(h, s, bp);
+            for (size = H::size(bp); !H::alloc(np); np = H::next(np)) {
+                Index::remove(h, s, np);
+                size += H::size(np);
+            }
+            H::set(bp, size, false);
+            Index::insert(h, s, bp);
+            merged = true;
+        }
+        return merged;
+    }
+};
+
+/*
+ * Allocator - the heap in one memlib context, which must be empty when
+ * init is called (mdriver resets it first). The region starts with the
+ * roots, then padding, the prologue and the epilogue:
+ *
+ *  | roots | pad | hdr(a) | ftr(a) | zero or more blocks | hdr(0:a) |
+ *
+ * with the pad putting every payload on an align boundary.
+ */
+template <class Header = Tags4, class Index = SegregatedLists<Lifo>,
+          class Fit = FirstFit, class Coalesce = ImmediateCoalesce>
+class Allocator {
+public:
+    using heap = Heap<Header>;
+
+    struct root_t {
+        std::uint32_t magic;      /* the combination's magic once init has run */
+        std::uint32_t heap_list;  /* offset of the prologue's payload */
+        typename Index::state index;
+        typename Coalesce::state coalesce;
+    };
+
+    static constexpr std::size_t align = heap::align;
+    static constexpr std::size_t root_size = detail::round_up(sizeof(root_t), align);
+    static constexpr std::size_t init_size = root_size + 2 * align;  /* roots to epilogue */
+    static constexpr std::size_t chunk = 1 << 12;                    /* heap growth */
+
+    /* "mmP" and a byte naming the combination */
+    static constexpr std::uint32_t magic =
+        0x6d6d5000u | Header::id << 5 | Index::id << 2 | Fit::id << 1 | Coalesce::id;
+
+    /* Block size for a request of size bytes */
+    static constexpr std::size_t adjust(std::size_t size)
+    {
+        return std::max(heap::min_block, detail::round_up(size + heap::overhead, align));
+    }
+
+    /* Shared regions are refused, as nothing serializes their users */
+    static int init(mem_ctx_t *ctx)
+    {
+        if (mem_ctx_is_shared(ctx))
+            return -1;
+        char *lo = static_cast<char *>(mem_ctx_sbrk(ctx, init_size));
+
+        if (lo == (char *)-1 || lo != mem_ctx_heap_lo(ctx))
+            return -1;
+        heap h{ctx, lo};
+        root_t &r = root(h);
+        char *prologue = lo + root_size + align;
+
+        std::memset(&r, 0, sizeof(r));
+        std::memset(lo + root_size, 0, align - heap::wsize);
+        heap::set(prologue, heap::overhead, true);
+        heap::hdr(heap::next(prologue)) = 1;
+        r.heap_list = h.off(prologue);
+        r.magic = magic;
+        return extend(h, r, chunk) == nullptr ? -1 : 0;
+    }
+
+    /* Adopt a heap of this combination already in the region of ctx */
+    static int attach(mem_ctx_t *ctx)
+    {
+        if (mem_ctx_is_shared(ctx) || mem_ctx_heapsize(ctx) < init_size ||
+            static_cast<root_t *>(mem_ctx_heap_lo(ctx))->magic != magic)
+            return -1;
+        return 0;
+    }
+
+    /* Back to one free chunk, in time independent of the heap's size */
+    static int reset(mem_ctx_t *ctx)
+    {
+        if (attach(ctx) < 0)
+            return -1;
+        heap h = view(ctx);
+        root_t &r = root(h);
+        char *bp = h.ptr(r.heap_list) + heap::overhead;
+
+        mem_ctx_reset_brk(ctx);
+        if (mem_ctx_sbrk(ctx, init_size + chunk) == (void *)-1)
+            return -1;
+        heap::set(bp, chunk, false);
+        heap::hdr(heap::next(bp)) = 1;
+        std::memset(&r.index, 0, sizeof(r.index));
+        std::memset(&r.coalesce, 0, sizeof(r.coalesce));
+        Index::insert(h, r.index, bp);
+        return 0;
+    }
+
+    static int snapshot(mem_ctx_t *ctx, std::FILE *fp)
+    {
+        std::size_t size = mem_ctx_heapsize(ctx);
+
+        if (std::fwrite(&size, sizeof(size), 1, fp) != 1 ||
+            std::fwrite(mem_ctx_heap_lo(ctx), 1, size, fp) != size)
+            return -1;
+        return 0;
+    }
+
+    /* On failure ctx holds no heap until init or restore succeeds */
+    static int restore(mem_ctx_t *ctx, std::FILE *fp)
+    {
+        std::size_t size;
+
+        if (std::fread(&size, sizeof(size), 1, fp) != 1)
+            return -1;
+        mem_ctx_reset_brk(ctx);
+        if (mem_ctx_sbrk(ctx, size) == (void *)-1 ||
+            std::fread(mem_ctx_heap_lo(ctx), 1, size, fp) != size || attach(ctx) < 0) {
+            if (mem_ctx_heapsize(ctx) >= sizeof(root_t))
+                static_cast<root_t *>(mem_ctx_heap_lo(ctx))->magic = 0;
+            return -1;
+        }
+        return 0;
+    }
+
+    static void *malloc(mem_ctx_t *ctx, std::size_t size)
+    {
+        if (size == 0)
+            return nullptr;
+        heap h = view(ctx);
+        root_t &r = root(h);
+        std::size_t asize = adjust(size);
+        char *bp = fit(h, r, asize);
+
+        if (bp == nullptr)
+            return nullptr;
+        place(h, r, bp, asize);
+        return bp;
+    }
+
+    static void free(mem_ctx_t *ctx, void *ptr)
+    {
+        if (ptr == nullptr)
+            return;
+        heap h = view(ctx);
+        root_t &r = root(h);
+        char *bp = static_cast<char *>(ptr);
+
+        heap::set(bp, heap::size(bp), false);
+        Index::insert(h, r.index, Coalesce::template freed<Index>(h, r.index, r.coalesce, bp));
+    }
+
+    /* malloc, copy and free, as mm.c does */
+    static void *realloc(mem_ctx_t *ctx, void *ptr, std::size_t size)
+    {
+        void *newp;
+
+        if (ptr == nullptr)
+            return malloc(ctx, size);
+        if (size == 0) {
+            free(ctx, ptr);
+            return nullptr;
+        }
+        if ((newp = malloc(ctx, size)) == nullptr)
+            return nullptr;
+        std::memcpy(newp, ptr, std::min(size, usable_size(ptr)));
+        free(ctx, ptr);
+        return newp;
+    }
+
+    /* A fit with room for a free block in front of the aligned payload */
+    static void *memalign(mem_ctx_t *ctx, std::size_t alignment, std::size_t size)
+    {
+        if (alignment <= align)
+            return malloc(ctx, size);
+        if ((alignment & (alignment - 1)) != 0 || size == 0)
+            return nullptr;
+        heap h = view(ctx);
+        root_t &r = root(h);
+        std::size_t asize = adjust(size), gap;
+        char *bp = fit(h, r, asize + alignment + heap::min_block);
+        char *ap;
+
+        if (bp == nullptr)
+            return nullptr;
+        ap = bp + (detail::round_up(reinterpret_cast<std::uintptr_t>(bp), alignment) -
+                   reinterpret_cast<std::uintptr_t>(bp));
+        while (ap != bp && std::size_t(ap - bp) < heap::min_block)
+            ap += alignment;
+        if ((gap = ap - bp) > 0) {
+            std::size_t csize = heap::size(bp);
+
+            Index::remove(h, r.index, bp);
+            heap::set(bp, gap, false);
+            Index::insert(h, r.index, bp);
+            heap::set(ap, csize - gap, false);
+            Index::insert(h, r.index, ap);
+        }
+        place(h, r, ap, asize);
+        return ap;
+    }
+
+    static std::size_t usable_size(void *ptr)
+    {
+        return heap::size(static_cast<char *>(ptr)) - heap::overhead;
+    }
+
+    static unsigned size_class(std::size_t size) { return Index::size_class(adjust(size)); }
+
+    static void checkheap(mem_ctx_t *ctx, bool verbose)
+    {
+        heap h = view(ctx);
+        root_t &r = root(h);
+        char *first = h.ptr(r.heap_list), *bp;
+        int nfree = 0;
+
+        if (verbose)
+            std::printf("Heap (%p):\n", static_cast<void *>(first));
+        if (heap::size(first) != heap::overhead || !heap::alloc(first))
+            std::printf("Bad prologue header\n");
+        for (bp = first; heap::size(bp) > 0; bp = heap::next(bp)) {
+            if (verbose)
+                std::printf("%p: [%zu:%c]\n", static_cast<void *>(bp), heap::size(bp),
+                            heap::alloc(bp) ? 'a' : 'f');
+            if (reinterpret_cast<std::uintptr_t>(bp) % align)
+                std::printf("Error: %p is not %zu-byte aligned\n", static_cast<void *>(bp), align);
+            if (heap::hdr(bp) != heap::ftr(bp))
+                std::printf("Error: header does not match footer\n");
+            if (Coalesce::keeps_apart && !heap::alloc(bp) && !heap::alloc(heap::next(bp)))
+                std::printf("Error: %p and the next block are both free\n",
+                            static_cast<void *>(bp));
+        }
+        if (!heap::alloc(bp))
+            std::printf("Bad epilogue header\n");
+
+        /* Every block on a free list is free and on the list of its size */
+        for (unsigned c = 0; c < Index::nlists; c++) {
+            for (bp = h.ptr(Index::head(r.index, c)); bp != nullptr; bp = h.succ(bp)) {
+                if (heap::alloc(bp) || !Index::belongs(c, heap::size(bp)))
+                    std::printf("Error: %p does not belong on free list %u\n",
+                                static_cast<void *>(bp), c);
+                nfree++;
+            }
+        }
+        if (nfree != Index::count(r.index))
+            std::printf("Error: %d blocks on the free lists, %d counted\n", nfree,
+                        Index::count(r.index));
+    }
+
+private:
+    static heap view(mem_ctx_t *ctx)
+    {
+        return heap{ctx, static_cast<char *>(mem_ctx_heap_lo(ctx))};
+    }
+    static root_t &root(const heap &h) { return *reinterpret_cast<root_t *>(h.base); }
+
+    /* A free block of at least asize bytes, still on its list */
+    static char *fit(heap &h, root_t &r, std::size_t asize)
+    {
+        char *bp = Index::template find<Fit>(h, r.index, asize);
+
+        if (bp == nullptr &&
+            Coalesce::template missed<Index>(h, r.index, r.coalesce, h.ptr(r.heap_list)))
+            bp = Index::template find<Fit>(h, r.index, asize);
+        if (bp == nullptr)
+            bp = extend(h, r, std::max(asize, chunk));
+        return bp;
+    }
+
+    /* Grow the heap by a free block of size bytes and return it */
+    static char *extend(heap &h, root_t &r, std::size_t size)
+    {
+        char *bp;
+
+        size = detail::round_up(size, align);
+        if (mem_ctx_heapsize(h.ctx) + size > 0xffffffffUL)
+            return nullptr;  /* beyond what a 32-bit offset can reach */
+        if ((bp = static_cast<char *>(mem_ctx_sbrk(h.ctx, int(size)))) == (char *)-1)
+            return nullptr;
+        heap::set(bp, size, false);  /* over the old epilogue */
+        heap::hdr(heap::next(bp)) = 1;
+        bp = Coalesce::template freed<Index>(h, r.index, r.coalesce, bp);
+        Index::insert(h, r.index, bp);
+        return bp;
+    }
+
+    /* Allocate asize bytes at the start of free block bp, splitting it */
+    static void place(heap &h, root_t &r, char *bp, std::size_t asize)
+    {
+        std::size_t csize = heap::size(bp);
+
+        Index::remove(h, r.index, bp);
+        if (csize - asize >= heap::min_block) {
+            heap::set(bp, asize, true);
+            heap::set(heap::next(bp), csize - asize, false);
+            Index::insert(h, r.index, heap::next(bp));
+        } else {
+            heap::set(bp, csize, true);
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * mm_preload.c - Run real programs on mm.c through LD_PRELOAD
+ *
+ * libmmpreload.so (see the Makefile) interposes malloc, free, calloc,
+ * realloc, memalign, aligned_alloc, valloc, posix_memalign and
+ * malloc_usable_size, and serves them from an MM_THREADSAFE mm heap in
+ * the default memlib context, i.e. in one mmap reservation:
+ *
+ *	unix> LD_PRELOAD=./libmmpreload.so sort big.txt > /dev/null
+ *
+ * The heap is set up by the first request. Requests that arrive while
+ * that is under way, or while dlsym looks up one of the libc functions
+ * below, come from the same thread and are served from a small static
+ * boot arena instead, which is never given back. Blocks that are
+ * neither in the heap nor in the boot arena were allocated by libc
+ * behind the shim's back and go to the real libc functions, looked up
+ * with dlsym on first use.
+ *
+ * mm blocks are only 8-byte aligned, so every request is served with
+ * mm_memalign at least to MALLOC_ALIGN, the alignment of max_align_t
+ * that malloc promises (16 bytes on x86-64). For the same reason
+ * realloc does its own moving instead of calling mm_realloc.
+ *
+ * Like glibc, the shim holds the heap lock across fork, so that the
+ * child does not inherit it taken by a thread that it does not have.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define PRELOAD_MAX_HEAP (1UL<<30)  /* heap cap unless MEM_MAX_HEAP is set */
+#define BOOT_SIZE        (1<<16)    /* bytes in the boot arena */
+#define BOOT_ALIGN       16         /* alignment of boot arena blocks */
+#define MALLOC_ALIGN     _Alignof(max_align_t)  /* alignment malloc promises */
+
+#define HEAP_NONE   0     /* states of the heap */
+#define HEAP_INIT   1
+#define HEAP_READY  2
+
+static int heap_state = HEAP_NONE;
+static pthread_mutex_t heap_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int in_shim;  /* this thread is setting up the heap or in dlsym */
+
+static char boot_arena[BOOT_SIZE] __attribute__((aligned(BOOT_ALIGN)));
+static size_t boot_used;      /* bytes taken from the boot arena */
+
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static size_t (*real_usable_size)(void *);
+
+static void heap_start(void);
+static void *heap_alloc(size_t align, size_t size);
+static void *boot_alloc(size_t size);
+static size_t boot_size(void *ptr);
+static void *real_fn(const char *name);
+static void die(const char *msg);
+static void fork_prepare(void);
+static void fork_release(void);
+
+#define IN_BOOT(p) ((char *)(p) >= boot_arena && (char *)(p) < boot_arena + BOOT_SIZE)
+#define IN_HEAP(p) (heap_state == HEAP_READY && \
+                    (char *)(p) >= (char *)mem_heap_lo() && \
+                    (char *)(p) <= (char *)mem_heap_hi())
+
+void *malloc(size_t size)
+{
+    void *ptr;
+
+    if (in_shim)
+        return boot_alloc(size);
+    heap_start();
+    if ((ptr = heap_alloc(MALLOC_ALIGN, size)) == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IN_BOOT(ptr))
+        return;
+    if (IN_HEAP(ptr)) {
+        mm_free(ptr);
+        return;
+    }
+    if (real_free == NULL)
+        real_free = real_fn("free");
+    real_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && nmemb > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* The boot arena is static and never reused, so it is still zero */
+    if (in_shim)
+        return boot_alloc(nmemb * size);
+
+    /* heap_alloc, not malloc, or gcc turns malloc+memset back into calloc */
+    heap_start();
+    if ((ptr = heap_alloc(MALLOC_ALIGN, nmemb * size)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *newptr;
+    size_t oldsize;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (!IN_HEAP(ptr) && !IN_BOOT(ptr)) {
+        if (real_realloc == NULL)
+            real_realloc = real_fn("realloc");
+        return real_realloc(ptr, size);
+    }
+
+    /* A heap block stays if it fits and is at least half used */
+    if (IN_HEAP(ptr)) {
+        oldsize = mm_usable_size(ptr);
+        if (size <= oldsize && size >= oldsize / 2)
+            return ptr;
+    }
+    else
+        oldsize = boot_size(ptr);
+    if ((newptr = malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+    free(ptr);
+    return newptr;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *ptr;
+
+    if (align == 0 || (align & (align - 1)) || align % sizeof(void *) != 0)
+        return EINVAL;
+    if (in_shim) {
+        if (align > BOOT_ALIGN)
+            return ENOMEM;
+        ptr = boot_alloc(size);
+    }
+    else {
+        heap_start();
+        ptr = heap_alloc(align, size);
+    }
+    if (ptr == NULL)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *ptr = NULL;
+    int err;
+
+    /* memalign takes any power of two, posix_memalign only multiples of a pointer */
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    if ((err = posix_memalign(&ptr, align, size)) != 0) {
+        errno = err;
+        return NULL;
+    }
+    return ptr;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    if (IN_BOOT(ptr))
+        return boot_size(ptr);
+    if (IN_HEAP(ptr))
+        return mm_usable_size(ptr);
+    if (real_usable_size == NULL)
+        real_usable_size = real_fn("malloc_usable_size");
+    return real_usable_size(ptr);
+}
+
+/*
+ * heap_start - Set up the heap on the first request. Other threads
+ *     wait for it; the thread doing it is in_shim meanwhile, so what it
+ *     allocates on the way comes from the boot arena.
+ */
+static void heap_start(void)
+{
+    if (__atomic_load_n(&heap_state, __ATOMIC_ACQUIRE) == HEAP_READY)
+        return;
+
+    pthread_mutex_lock(&heap_init_lock);
+    if (heap_state == HEAP_NONE) {
+        heap_state = HEAP_INIT;
+        in_shim = 1;
+        if (getenv("MEM_MAX_HEAP") == NULL)
+            mem_set_max_heap(PRELOAD_MAX_HEAP);
+        mem_init();
+        if (mm_init_flags(MM_THREADSAFE) < 0)
+            die("mm_init failed");
+        if (pthread_atfork(fork_prepare, fork_release, fork_release) != 0)
+            die("pthread_atfork failed");
+        in_shim = 0;
+        __atomic_store_n(&heap_state, HEAP_READY, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&heap_init_lock);
+}
+
+/*
+ * heap_alloc - Allocate size bytes, at least 1, from the heap, aligned
+ *     to align but never less than MALLOC_ALIGN
+ */
+static void *heap_alloc(size_t align, size_t size)
+{
+    return mm_memalign(align > MALLOC_ALIGN ? align : MALLOC_ALIGN, size ? size : 1);
+}
+
+/*
+ * fork_prepare - Take the heap locks before fork, waiting for any other
+ *     thread to leave the allocator. fork_release lets them go again,
+ *     in the parent and in the child, whose only thread is the one
+ *     that took them.
+ */
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&heap_init_lock);
+    if (heap_state == HEAP_READY)
+        mm_lock();
+}
+
+static void fork_release(void)
+{
+    if (heap_state == HEAP_READY)
+        mm_unlock();
+    pthread_mutex_unlock(&heap_init_lock);
+}
+
+/*
+ * boot_alloc - Take size bytes from the boot arena. Each block is
+ *     preceded by its size, so that realloc can move it to the heap.
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t need = BOOT_ALIGN + ((size + BOOT_ALIGN-1) & ~(size_t)(BOOT_ALIGN-1));
+    size_t old = __atomic_fetch_add(&boot_used, need, __ATOMIC_RELAXED);
+    char *ptr;
+
+    if (old + need > BOOT_SIZE)
+        die("boot arena exhausted");
+    ptr = boot_arena + old + BOOT_ALIGN;
+    *(size_t *)(ptr - sizeof(size_t)) = size;
+    return ptr;
+}
+
+static size_t boot_size(void *ptr)
+{
+    return *(size_t *)((char *)ptr - sizeof(size_t));
+}
+
+/*
+ * real_fn - Look up the libc version of an interposed function. dlsym
+ *     may allocate, and those requests go to the boot arena.
+ */
+static void *real_fn(const char *name)
+{
+    void *fn;
+    int was_in_shim = in_shim;
+
+    in_shim = 1;
+    fn = dlsym(RTLD_NEXT, name);
+    in_shim = was_in_shim;
+    if (fn == NULL)
+        die("cannot find the libc allocator");
+    return fn;
+}
+
+/*
+ * die - Report a fatal error without allocating and abort
+ */
+static void die(const char *msg)
+{
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "libmmpreload: %s\n", msg);
+    if (write(STDERR_FILENO, buf, strlen(buf)) < 0)
+        abort();
+    abort();
+}
@@ -0,0 +1,84 @@
+/*
+ * mm_resource.hpp - std::pmr memory resources over the mm allocator
+ *
+ * mm::memory_resource hands out blocks of one mm heap, the one in the
+ * default memlib context unless it is given another, so C++ containers
+ * can use mm without replacing the global operator new. The heap must
+ * have been set up (mm_init or mm_ctx_init_flags) beforehand, and the
+ * resource is exactly as thread-safe as the heap's MM_* flags make it.
+ *
+ * mm::unsynchronized_pool_resource is the standard pool resource with
+ * an mm::memory_resource as its upstream, for containers of many small
+ * objects used from one thread.
+ */
+#ifndef MM_RESOURCE_HPP
+#define MM_RESOURCE_HPP
+
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+
+extern "C" {
+#include "mm.h"
+#include "memlib.h"
+}
+
+namespace mm {
+
+class memory_resource : public std::pmr::memory_resource {
+public:
+    explicit memory_resource(mem_ctx_t *ctx = mem_default_ctx()) : ctx_(ctx) {}
+
+    mem_ctx_t *context() const { return ctx_; }
+
+private:
+    /* mm blocks are DSIZE-aligned; stricter alignments go to mm_memalign */
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        void *p;
+
+        if (bytes == 0)
+            bytes = 1;
+        p = (align <= alignof(std::max_align_t) && align <= 8) ?
+            mm_ctx_malloc(ctx_, bytes) : mm_ctx_memalign(ctx_, align, bytes);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t) override
+    {
+        mm_ctx_free_sized(ctx_, p, bytes);
+    }
+
+    /* Blocks of one heap can be freed through any resource on it */
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const memory_resource *o = dynamic_cast<const memory_resource *>(&other);
+
+        return o != nullptr && o->ctx_ == ctx_;
+    }
+
+    mem_ctx_t *ctx_;
+};
+
+namespace detail {
+/* Holds the upstream so that it is built before the pool and outlives it */
+struct upstream_holder {
+    explicit upstream_holder(mem_ctx_t *ctx) : upstream_(ctx) {}
+    memory_resource upstream_;
+};
+}
+
+class unsynchronized_pool_resource : private detail::upstream_holder,
+                                     public std::pmr::unsynchronized_pool_resource {
+public:
+    explicit unsynchronized_pool_resource(mem_ctx_t *ctx = mem_default_ctx(),
+                                          const std::pmr::pool_options &opts = {})
+        : detail::upstream_holder(ctx),
+          std::pmr::unsynchronized_pool_resource(opts, &upstream_) {}
+};
+
+}
+
+#endif
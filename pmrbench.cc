@@ -0,0 +1,150 @@
+/*
+ * pmrbench.cc - Benchmark of std::pmr containers on the mm resources
+ *
+ * Runs the same std::pmr::vector and std::pmr::unordered_map workloads
+ * on the default resource (new/delete), on mm::memory_resource, and on
+ * an unsynchronized pool over each of them, and prints the time of the
+ * best of ROUNDS runs. The mm heap is reset between runs.
+ *
+ * Then it times mm_free against mm_free_sized, what sized operator
+ * delete calls (see mm_new.cc), on an MM_PERCPU heap.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "mm_resource.hpp"
+
+#define ROUNDS    5          /* runs of each workload, the best counts */
+#define VECTORS   2000       /* vectors built by the vector workload */
+#define VECLEN    500        /* elements pushed onto each of them */
+#define KEYS      200000     /* keys inserted by the map workload */
+#define FREES     (1<<20)    /* frees timed by the sized-free benchmark */
+#define FREELIVE  (1<<18)    /* blocks it keeps allocated */
+#define FREEMAX   240        /* largest size they ask for */
+
+typedef void (*workload_t)(std::pmr::memory_resource *mr);
+
+/* Build many short vectors one push_back at a time, keeping every other */
+static void vector_workload(std::pmr::memory_resource *mr)
+{
+    std::pmr::vector<std::pmr::vector<int>> keep(mr);
+
+    for (int i = 0; i < VECTORS; i++) {
+        std::pmr::vector<int> v(mr);
+        for (int j = 0; j < VECLEN; j++)
+            v.push_back(i + j);
+        if (i % 2 == 0)
+            keep.push_back(std::move(v));
+    }
+}
+
+/* Insert KEYS keys, then erase every other one and insert them again */
+static void map_workload(std::pmr::memory_resource *mr)
+{
+    std::pmr::unordered_map<int, long> m(mr);
+
+    for (int i = 0; i < KEYS; i++)
+        m.emplace(i * 7919, i);
+    for (int i = 0; i < KEYS; i += 2)
+        m.erase(i * 7919);
+    for (int i = 0; i < KEYS; i += 2)
+        m.emplace(i * 7919, i);
+}
+
+/* Best time of ROUNDS runs of w on the resource made by kind, in ms */
+static double run(workload_t w, int kind)
+{
+    double best = 0;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        mm_reset();
+        mm::memory_resource mmr;
+        std::pmr::unsynchronized_pool_resource pool(std::pmr::new_delete_resource());
+        mm::unsynchronized_pool_resource mmpool;
+        std::pmr::memory_resource *mrs[] = {
+            std::pmr::new_delete_resource(), &mmr, &pool, &mmpool
+        };
+
+        auto t0 = std::chrono::steady_clock::now();
+        w(mrs[kind]);
+        auto t1 = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (r == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+/*
+ * Best time of ROUNDS runs of FREES frees, in ns per free: each frees a
+ * random one of FREELIVE small blocks and allocates it again, so that
+ * the headers mm_free reads are mostly not in the cache
+ */
+static double free_run(bool sized)
+{
+    static void *blocks[FREELIVE];
+    static size_t sizes[FREELIVE];
+    static int order[FREES];
+    double best = 0;
+
+    srand(1);
+    for (int j = 0; j < FREELIVE; j++)
+        sizes[j] = 1 + rand() % FREEMAX;
+    for (int i = 0; i < FREES; i++)
+        order[i] = rand() % FREELIVE;
+    for (int r = 0; r < ROUNDS; r++) {
+        std::chrono::steady_clock::duration t(0);
+        mm_reset();
+        for (int j = 0; j < FREELIVE; j++)
+            blocks[j] = mm_malloc(sizes[j]);
+        for (int i = 0; i < FREES; i++) {
+            int j = order[i];
+            auto t0 = std::chrono::steady_clock::now();
+            if (sized)
+                mm_free_sized(blocks[j], sizes[j]);
+            else
+                mm_free(blocks[j]);
+            t += std::chrono::steady_clock::now() - t0;
+            blocks[j] = mm_malloc(sizes[j]);
+        }
+        double ns = std::chrono::duration<double, std::nano>(t).count() / FREES;
+        if (r == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int main(void)
+{
+    static const char *kinds[] = {"new_delete", "mm", "pool(new_delete)", "pool(mm)"};
+    static const struct {
+        const char *name;
+        workload_t w;
+    } workloads[] = {{"vector", vector_workload}, {"unordered_map", map_workload}};
+
+    mem_set_max_heap(1UL << 30);
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "pmrbench: mm_init failed\n");
+        exit(1);
+    }
+
+    printf("%-15s%18s%10s\n", "workload", "resource", "ms");
+    for (const auto &wl : workloads)
+        for (int k = 0; k < 4; k++)
+            printf("%-15s%18s%10.2f\n", wl.name, kinds[k], run(wl.w, k));
+
+    mem_reset_brk();
+    if (mm_init_flags(MM_THREADSAFE | MM_PERCPU) < 0) {
+        fprintf(stderr, "pmrbench: mm_init_flags failed\n");
+        exit(1);
+    }
+    printf("\n%-15s%18s%10s\n", "free", "heap", "ns/free");
+    printf("%-15s%18s%10.2f\n", "mm_free", "percpu", free_run(false));
+    printf("%-15s%18s%10.2f\n", "mm_free_sized", "percpu", free_run(true));
+    exit(0);
+}